@@ -0,0 +1,669 @@
+#define _XOPEN_SOURCE 700
+// RTLD_NEXT
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <dlfcn.h>
+#include <ftw.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "handlers.h"
+
+#define DEFAULT_MIN_TIME_MS 200
+#define MAX_ITERATIONS 100000000L
+#define PEER_BUFFER_SIZE 65536
+
+/**
+ * Number of allocation calls made in this process. The benchmark client
+ * never allocates while a benchmark runs, so the count covers the handlers
+ * and the libc calls they make. The client runs on its own thread, hence
+ * the atomic counter.
+*/
+static atomic_ulong allocations = 0;
+
+#ifdef BENCH_COUNT_ALLOCATIONS
+// malloc, calloc, realloc and free defined here take precedence over libc's
+// for every caller, libc included, and forward to the next definition.
+static void* (*realMalloc)(size_t size);
+static void* (*realCalloc)(size_t count, size_t size);
+static void* (*realRealloc)(void* pointer, size_t size);
+static void (*realFree)(void* pointer);
+
+// dlsym may allocate while the real functions are being looked up. Those
+// few allocations are served from here and never released.
+static _Alignas(max_align_t) unsigned char bootstrap[4096];
+static size_t bootstrapUsed = 0;
+
+static int isBootstrap(const void* pointer) {
+  return (const unsigned char*)pointer >= bootstrap && (const unsigned char*)pointer < bootstrap + sizeof(bootstrap);
+}
+
+static void* bootstrapAllocate(size_t size) {
+  size = (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+  if (size > sizeof(bootstrap) - bootstrapUsed) {
+    return NULL;
+  }
+  void* pointer = bootstrap + bootstrapUsed;
+  bootstrapUsed += size;
+  return pointer;
+}
+
+/**
+ * @brief Looks up the allocator this binary interposes. The first
+ * allocation happens before main, while the process is single-threaded.
+*/
+static void findAllocator(void) {
+  static int resolving = 0;
+  if (resolving) {
+    return;
+  }
+  resolving = 1;
+  realMalloc = dlsym(RTLD_NEXT, "malloc");
+  realCalloc = dlsym(RTLD_NEXT, "calloc");
+  realRealloc = dlsym(RTLD_NEXT, "realloc");
+  realFree = dlsym(RTLD_NEXT, "free");
+  resolving = 0;
+}
+
+void* malloc(size_t size) {
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  if (realMalloc == NULL) {
+    findAllocator();
+  }
+  return realMalloc != NULL ? realMalloc(size) : bootstrapAllocate(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  if (realCalloc == NULL) {
+    findAllocator();
+  }
+  if (realCalloc != NULL) {
+    return realCalloc(count, size);
+  }
+  // The bootstrap buffer starts zeroed and is never reused
+  return size != 0 && count > SIZE_MAX / size ? NULL : bootstrapAllocate(count * size);
+}
+
+void* realloc(void* pointer, size_t size) {
+  atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+  if (realRealloc == NULL) {
+    findAllocator();
+  }
+  if (isBootstrap(pointer)) {
+    void* moved = malloc(size);
+    size_t available = (size_t)(bootstrap + sizeof(bootstrap) - (unsigned char*)pointer);
+    if (moved != NULL) {
+      memcpy(moved, pointer, size < available ? size : available);
+    }
+    return moved;
+  }
+  return realRealloc != NULL ? realRealloc(pointer, size) : NULL;
+}
+
+void free(void* pointer) {
+  if (pointer == NULL || isBootstrap(pointer)) {
+    return;
+  }
+  if (realFree == NULL) {
+    findAllocator();
+  }
+  realFree(pointer);
+}
+#endif
+
+/**
+ * State shared by a handler call and the benchmark client on the other
+ * end of the socketpair.
+*/
+typedef struct {
+  Connection client;
+  int peerSocket;
+  int clientSockets[MAX_CLIENTS];
+  const char* command;
+  const char* response;
+  const ChunkStore* store;
+  unsigned char* data;
+  size_t dataLength;
+  ChunkRef* chunks;
+  long count;
+  char* list;
+  size_t listLength;
+} BenchContext;
+
+/**
+ * A benchmark runs op on the main thread and, if set, peer on a second
+ * thread that plays the client for the same number of iterations.
+*/
+typedef struct {
+  const char* name;
+  char param[64];
+  void (*op)(BenchContext* ctx);
+  void (*peer)(BenchContext* ctx, long iterations);
+  size_t bytes;
+} Benchmark;
+
+typedef struct {
+  const Benchmark* bench;
+  BenchContext* ctx;
+  long iterations;
+} PeerArgs;
+
+static double minTimeNs = DEFAULT_MIN_TIME_MS * 1e6;
+static const char* filter = NULL;
+
+static double nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * @brief Fills a buffer with reproducible pseudo-random bytes, or with
+ * lowercase letters when text is set so that no EOT byte shows up in
+ * responses.
+*/
+static void fillBuffer(unsigned char* buffer, size_t length, unsigned long seed, int text) {
+  unsigned long x = seed * 2654435761UL + 1;
+  for (size_t i = 0; i < length; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    buffer[i] = text ? 'a' + (x % 26) : (unsigned char)x;
+  }
+}
+
+static int writeFile(const char* path, const unsigned char* data, size_t length) {
+  FILE* file = fopen(path, "w");
+  if (file == NULL || fwrite(data, 1, length, file) != length) {
+    perror(path);
+    if (file != NULL) {
+      fclose(file);
+    }
+    return -1;
+  }
+  return fclose(file);
+}
+
+static int removeEntry(const char* path, const struct stat* fileStat, int flag, struct FTW* ftw) {
+  (void)fileStat;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+static int sendAll(int socket, const void* data, size_t length) {
+  size_t sent = 0;
+  while (sent < length) {
+    ssize_t n = send(socket, (const char*)data + sent, length - sent, 0);
+    if (n < 0) {
+      perror("Send");
+      return -1;
+    }
+    sent += n;
+  }
+  return 0;
+}
+
+/**
+ * @brief Reads and discards data until count EOT delimiters have arrived.
+ *
+ * @return 0 on success, -1 if the connection failed.
+*/
+static int awaitResponses(int socket, long count, char* buffer, size_t size) {
+  while (count > 0) {
+    ssize_t n = recv(socket, buffer, size, 0);
+    if (n <= 0) {
+      perror("Receive");
+      return -1;
+    }
+    for (ssize_t i = 0; i < n; i++) {
+      if (buffer[i] == 4) {
+        count--;
+      }
+    }
+  }
+  return 0;
+}
+
+static void drainResponses(BenchContext* ctx, long iterations) {
+  char buffer[PEER_BUFFER_SIZE];
+  awaitResponses(ctx->peerSocket, iterations, buffer, sizeof(buffer));
+}
+
+/**
+ * @brief Plays the client side of a chunked upload: sends the chunk list,
+ * waits for the "Need" reply, sends the requested chunks and waits for the
+ * confirmation.
+*/
+static void uploadChunks(BenchContext* ctx, long iterations) {
+  char reply[PEER_BUFFER_SIZE];
+  for (long n = 0; n < iterations; n++) {
+    size_t length = 0;
+    ssize_t received;
+    if (sendAll(ctx->peerSocket, ctx->list, ctx->listLength) < 0) {
+      return;
+    }
+
+    // Read the "Need" reply up to its delimiter, leaving the confirmation
+    // in the socket
+    while (length == 0 || reply[length - 1] != 4) {
+      received = recv(ctx->peerSocket, reply + length, sizeof(reply) - 1 - length, MSG_PEEK);
+      if (received > 0) {
+        char* end = memchr(reply + length, 4, received);
+        if (end != NULL) {
+          received = end - (reply + length) + 1;
+        }
+        received = recv(ctx->peerSocket, reply + length, received, 0);
+      }
+      if (received <= 0) {
+        perror("Receive");
+        return;
+      }
+      length += received;
+    }
+    reply[length - 1] = '\0';
+
+    char* next = reply + 4;
+    long numNeeded = strtol(next, &next, 10);
+    size_t offset = 0;
+    long wanted = numNeeded > 0 ? strtol(next, &next, 10) : -1;
+    for (long i = 0, sent = 0; i < ctx->count && sent < numNeeded; i++) {
+      if (i == wanted) {
+        if (sendAll(ctx->peerSocket, ctx->data + offset, ctx->chunks[i].length) < 0) {
+          return;
+        }
+        if (++sent < numNeeded) {
+          wanted = strtol(next, &next, 10);
+        }
+      }
+      offset += ctx->chunks[i].length;
+    }
+
+    if (awaitResponses(ctx->peerSocket, 1, reply, sizeof(reply)) < 0) {
+      return;
+    }
+  }
+}
+
+static void* runPeer(void* arg) {
+  PeerArgs* args = (PeerArgs*)arg;
+  args->bench->peer(args->ctx, args->iterations);
+  return NULL;
+}
+
+/**
+ * @brief Runs a benchmark with a growing number of iterations until one
+ * run takes at least the minimum time, then prints one CSV row:
+ * name,param,iterations,ns_per_op,allocs_per_op,mb_per_s
+*/
+static void runBenchmark(const Benchmark* bench, BenchContext* ctx) {
+  if (filter != NULL && strstr(bench->name, filter) == NULL) {
+    return;
+  }
+
+  long iterations = 1;
+  while (1) {
+    pthread_t peer;
+    PeerArgs args = {bench, ctx, iterations};
+    if (bench->peer != NULL && pthread_create(&peer, NULL, runPeer, &args) != 0) {
+      perror("pthread_create");
+      return;
+    }
+
+    unsigned long allocationsBefore = atomic_load(&allocations);
+    double start = nowNs();
+    for (long i = 0; i < iterations; i++) {
+      bench->op(ctx);
+    }
+    double elapsed = nowNs() - start;
+    unsigned long allocated = atomic_load(&allocations) - allocationsBefore;
+
+    if (bench->peer != NULL) {
+      pthread_join(peer, NULL);
+    }
+
+    if (elapsed >= minTimeNs || iterations >= MAX_ITERATIONS) {
+      double nsPerOp = elapsed / iterations;
+      printf("%s,%s,%ld,%.1f,", bench->name, bench->param, iterations, nsPerOp);
+#ifdef BENCH_COUNT_ALLOCATIONS
+      printf("%.2f,", (double)allocated / iterations);
+#else
+      (void)allocated;
+      printf(",");
+#endif
+      if (bench->bytes > 0) {
+        printf("%.1f", bench->bytes / nsPerOp * 1e9 / (1024 * 1024));
+      }
+      printf("\n");
+      fflush(stdout);
+      return;
+    }
+
+    // Aim a bit past the minimum time, growing at most 100x per round
+    long next = elapsed > 0 ? (long)(iterations * 1.2 * minTimeNs / elapsed) + 1 : iterations * 100;
+    if (next > iterations * 100) {
+      next = iterations * 100;
+    }
+    iterations = next > MAX_ITERATIONS ? MAX_ITERATIONS : next;
+  }
+}
+
+/**
+ * @brief Sends what a handler queued, as the server's scheduler would.
+*/
+static void flush(BenchContext* ctx) {
+  queueFlush(&ctx->client.flow.output, ctx->client.flow.socket);
+}
+
+static void opResponse(BenchContext* ctx) {
+  responseToClientInChunk(&ctx->client, ctx->response);
+  flush(ctx);
+}
+
+static void opList(BenchContext* ctx) {
+  handleListCommand(&ctx->client, ctx->clientSockets);
+  flush(ctx);
+}
+
+static void opFiles(BenchContext* ctx) {
+  handleFilesCommand(&ctx->client, ctx->store);
+  flush(ctx);
+}
+
+static void opGet(BenchContext* ctx) {
+  handleGetCommand(&ctx->client, ctx->command, ctx->store);
+  flush(ctx);
+}
+
+static void opDispatch(BenchContext* ctx) {
+  handleCommand(&ctx->client, ctx->clientSockets, ctx->command, ctx->store);
+  flush(ctx);
+}
+
+static void opChunks(BenchContext* ctx) {
+  handleChunksCommand(&ctx->client, ctx->command, ctx->store);
+  flush(ctx);
+  while (ctx->client.state != CONNECTION_IDLE) {
+    if (handleUploadData(&ctx->client, ctx->store, (size_t)-1) < 0) {
+      break;
+    }
+    flush(ctx);
+  }
+}
+
+static void opCrc32c(BenchContext* ctx) {
+  volatile uint32_t crc = crc32cUpdate(0, ctx->data, ctx->dataLength);
+  (void)crc;
+}
+
+static void opChunkBuffer(BenchContext* ctx) {
+  ChunkRef* chunks;
+  chunkBuffer(ctx->data, ctx->dataLength, &chunks);
+  free(chunks);
+}
+
+static void benchResponses(BenchContext* ctx) {
+  static const size_t sizes[] = {64, 4096, 65536};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    char* response = (char*)malloc(sizes[i] + 1);
+    memset(response, 'x', sizes[i]);
+    response[sizes[i]] = '\0';
+    ctx->response = response;
+
+    Benchmark bench = {"responseToClientInChunk", "", opResponse, drainResponses, sizes[i]};
+    snprintf(bench.param, sizeof(bench.param), "bytes=%zu", sizes[i]);
+    runBenchmark(&bench, ctx);
+    free(response);
+  }
+}
+
+/**
+ * @brief Benchmarks "List" with up to MAX_CLIENTS real loopback TCP
+ * connections, since the handler looks up each client's peer address.
+*/
+static void benchList(BenchContext* ctx) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  socklen_t addrLen = sizeof(addr);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      listen(listener, MAX_CLIENTS) < 0 ||
+      getsockname(listener, (struct sockaddr*)&addr, &addrLen) < 0) {
+    perror("Listen");
+    return;
+  }
+
+  int connected[MAX_CLIENTS];
+  int numClients = 0;
+  static const int counts[] = {1, 5, MAX_CLIENTS};
+  for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    while (numClients < counts[c]) {
+      connected[numClients] = socket(AF_INET, SOCK_STREAM, 0);
+      if (connect(connected[numClients], (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("Connect");
+        return;
+      }
+      ctx->clientSockets[numClients] = accept(listener, NULL, NULL);
+      numClients++;
+    }
+
+    Benchmark bench = {"handleListCommand", "", opList, drainResponses, 0};
+    snprintf(bench.param, sizeof(bench.param), "clients=%d", numClients);
+    runBenchmark(&bench, ctx);
+  }
+
+  ctx->command = "List";
+  Benchmark list = {"handleCommand", "command=List", opDispatch, drainResponses, 0};
+  runBenchmark(&list, ctx);
+  ctx->command = "Bogus";
+  Benchmark invalid = {"handleCommand", "command=invalid", opDispatch, drainResponses, 0};
+  runBenchmark(&invalid, ctx);
+
+  for (int i = 0; i < numClients; i++) {
+    close(ctx->clientSockets[i]);
+    close(connected[i]);
+    ctx->clientSockets[i] = -1;
+  }
+  close(listener);
+}
+
+static void benchFiles(BenchContext* ctx) {
+  static const int counts[] = {10, 100, 1000};
+  for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    char path[64];
+    snprintf(path, sizeof(path), "files%d", counts[c]);
+    if (mkdir(path, 0755) < 0 || chdir(path) < 0) {
+      perror(path);
+      return;
+    }
+    for (int i = 0; i < counts[c]; i++) {
+      snprintf(path, sizeof(path), "file%04d.txt", i);
+      writeFile(path, (const unsigned char*)"x", 1);
+    }
+
+    Benchmark bench = {"handleFilesCommand", "", opFiles, drainResponses, 0};
+    snprintf(bench.param, sizeof(bench.param), "files=%d", counts[c]);
+    runBenchmark(&bench, ctx);
+    if (chdir("..") < 0) {
+      perror("chdir");
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Benchmarks "Get" for files in the working directory and for the
+ * same files reassembled from the chunk store, and the "Unchanged" answer
+ * to a client that sends the checksum of its own copy.
+*/
+static void benchGet(BenchContext* ctx, const ChunkStore* store) {
+  static const size_t sizes[] = {1024, 65536, 1024 * 1024, 16 * 1024 * 1024};
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    char filename[64];
+    char command[MAX_COMMAND_LENGTH];
+    snprintf(filename, sizeof(filename), "get%zu.txt", sizes[s]);
+    snprintf(command, sizeof(command), "Get %s", filename);
+
+    unsigned char* data = (unsigned char*)malloc(sizes[s]);
+    fillBuffer(data, sizes[s], s, 1);
+    writeFile(filename, data, sizes[s]);
+
+    ChunkRef* chunks;
+    long count = chunkBuffer(data, sizes[s], &chunks);
+    size_t offset = 0;
+    for (long i = 0; i < count; i++) {
+      storePutChunk(store, &chunks[i], data + offset);
+      offset += chunks[i].length;
+    }
+    uint32_t crc = crc32cUpdate(0, data, sizes[s]);
+    storeWriteManifest(store, filename, chunks, count, &crc);
+    free(chunks);
+    free(data);
+
+    ctx->command = command;
+    Benchmark bench = {"handleGetCommand", "", opGet, drainResponses, sizes[s]};
+    snprintf(bench.param, sizeof(bench.param), "bytes=%zu;source=plain", sizes[s]);
+    ctx->store = NULL;
+    runBenchmark(&bench, ctx);
+    snprintf(bench.param, sizeof(bench.param), "bytes=%zu;source=store", sizes[s]);
+    ctx->store = store;
+    runBenchmark(&bench, ctx);
+
+    // The client already has the file; the plain Gets above have cached
+    // its checksum, so neither source reads the content
+    char unchanged[MAX_COMMAND_LENGTH];
+    snprintf(unchanged, sizeof(unchanged), "Get %s %08x", filename, crc);
+    ctx->command = unchanged;
+    Benchmark skip = {"handleGetCommand", "", opGet, drainResponses, 0};
+    snprintf(skip.param, sizeof(skip.param), "bytes=%zu;source=plain;unchanged", sizes[s]);
+    ctx->store = NULL;
+    runBenchmark(&skip, ctx);
+    snprintf(skip.param, sizeof(skip.param), "bytes=%zu;source=store;unchanged", sizes[s]);
+    ctx->store = store;
+    runBenchmark(&skip, ctx);
+    ctx->store = NULL;
+  }
+}
+
+/**
+ * @brief Benchmarks chunking and checksumming on their own and chunked
+ * uploads, once without a store (every chunk is sent and written) and once
+ * into a store that already has every chunk (only the chunk list is
+ * exchanged).
+*/
+static void benchChunks(BenchContext* ctx, const ChunkStore* store) {
+  static const size_t sizes[] = {65536, 1024 * 1024, 16 * 1024 * 1024};
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    ctx->dataLength = sizes[s];
+    ctx->data = (unsigned char*)malloc(sizes[s]);
+    fillBuffer(ctx->data, sizes[s], 100 + s, 0);
+
+    Benchmark chunking = {"chunkBuffer", "", opChunkBuffer, NULL, sizes[s]};
+    snprintf(chunking.param, sizeof(chunking.param), "bytes=%zu", sizes[s]);
+    runBenchmark(&chunking, ctx);
+
+    Benchmark checksum = {"crc32cUpdate", "", opCrc32c, NULL, sizes[s]};
+    snprintf(checksum.param, sizeof(checksum.param), "bytes=%zu;impl=%s", sizes[s], crc32cImplementation());
+    runBenchmark(&checksum, ctx);
+
+    // The command carries only the header, the client sends the list
+    char command[MAX_COMMAND_LENGTH];
+    ctx->count = chunkBuffer(ctx->data, sizes[s], &ctx->chunks);
+    snprintf(command, sizeof(command), "Chunks upload.bin %ld\n", ctx->count);
+    ctx->list = (char*)malloc(ctx->count * (SHA256_HEX_LENGTH + 24) + 1);
+    ctx->listLength = 0;
+    for (long i = 0; i < ctx->count; i++) {
+      ctx->listLength += sprintf(ctx->list + ctx->listLength, "%s %zu\n",
+                                 ctx->chunks[i].hash, ctx->chunks[i].length);
+    }
+    ctx->command = command;
+
+    Benchmark upload = {"handleChunksCommand", "", opChunks, uploadChunks, sizes[s]};
+    snprintf(upload.param, sizeof(upload.param), "bytes=%zu;store=none", sizes[s]);
+    ctx->store = NULL;
+    runBenchmark(&upload, ctx);
+
+    size_t offset = 0;
+    for (long i = 0; i < ctx->count; i++) {
+      storePutChunk(store, &ctx->chunks[i], ctx->data + offset);
+      offset += ctx->chunks[i].length;
+    }
+    snprintf(upload.param, sizeof(upload.param), "bytes=%zu;store=deduplicated", sizes[s]);
+    ctx->store = store;
+    runBenchmark(&upload, ctx);
+    ctx->store = NULL;
+
+    free(ctx->list);
+    free(ctx->chunks);
+    free(ctx->data);
+  }
+}
+
+int main(int argc, char** argv) {
+  // Benchmarks print CSV rows to stdout so that runs of different commits
+  // can be compared with standard tools.
+  if (argc > 3) {
+    printf("Usage: %s [min milliseconds per benchmark] [name filter]\n", argv[0]);
+    return 1;
+  }
+  if (argc >= 2) {
+    minTimeNs = atof(argv[1]) * 1e6;
+  }
+  if (argc == 3) {
+    filter = argv[2];
+  }
+
+  char root[] = "/tmp/rn-bench.XXXXXX";
+  if (mkdtemp(root) == NULL || chdir(root) < 0) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  ChunkStore store;
+  if (storeOpen(&store, "store") < 0) {
+    return 1;
+  }
+
+  int sockets[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0) {
+    perror("socketpair");
+    return 1;
+  }
+
+  BenchContext ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  connectionInit(&ctx.client, sockets[0], 0, MAX_RESPONSE_LENGTH);
+  ctx.peerSocket = sockets[1];
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    ctx.clientSockets[i] = -1;
+  }
+
+  printf("name,param,iterations,ns_per_op,allocs_per_op,mb_per_s\n");
+  benchResponses(&ctx);
+  benchList(&ctx);
+  benchFiles(&ctx);
+  benchGet(&ctx, &store);
+  benchChunks(&ctx, &store);
+
+  close(sockets[0]);
+  close(sockets[1]);
+  if (chdir("/") < 0 || nftw(root, removeEntry, 16, FTW_DEPTH | FTW_PHYS) < 0) {
+    perror("cleanup");
+  }
+  return 0;
+}
@@ -0,0 +1,155 @@
+#include "chunk.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+// Masks are taken from the top bits of the gear hash, which depend on the
+// last 64 input bytes. Before the average size a stricter mask (15 bits)
+// is used and after it a looser one (11 bits), which pulls the chunk size
+// distribution towards CHUNK_AVG_SIZE (2^13).
+#define MASK_STRICT (~(uint64_t)0 << (64 - 15))
+#define MASK_LOOSE (~(uint64_t)0 << (64 - 11))
+
+static uint64_t gear[256];
+static int gearReady = 0;
+
+/**
+ * @brief Fills the gear table from a fixed splitmix64 sequence so that
+ * every build of the client and the server cuts at the same positions.
+*/
+static void initGear(void) {
+  uint64_t seed = 0x5245434845524e45ULL;
+  for (int i = 0; i < 256; i++) {
+    uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    gear[i] = z ^ (z >> 31);
+  }
+  gearReady = 1;
+}
+
+size_t nextChunkBoundary(const unsigned char* data, size_t length) {
+  if (!gearReady) {
+    initGear();
+  }
+
+  if (length <= CHUNK_MIN_SIZE) {
+    return length;
+  }
+
+  size_t limit = length < CHUNK_MAX_SIZE ? length : CHUNK_MAX_SIZE;
+  size_t normal = limit < CHUNK_AVG_SIZE ? limit : CHUNK_AVG_SIZE;
+  uint64_t hash = 0;
+  size_t i = CHUNK_MIN_SIZE;
+
+  for (; i < normal; i++) {
+    hash = (hash << 1) + gear[data[i]];
+    if ((hash & MASK_STRICT) == 0) {
+      return i + 1;
+    }
+  }
+  for (; i < limit; i++) {
+    hash = (hash << 1) + gear[data[i]];
+    if ((hash & MASK_LOOSE) == 0) {
+      return i + 1;
+    }
+  }
+  return limit;
+}
+
+long chunkBuffer(const unsigned char* data, size_t length, ChunkRef** chunks) {
+  size_t capacity = 0;
+  long count = 0;
+  size_t offset = 0;
+
+  *chunks = NULL;
+  while (offset < length) {
+    if ((size_t)count == capacity) {
+      capacity = capacity == 0 ? length / CHUNK_AVG_SIZE + 1 : capacity * 2;
+      ChunkRef* grown = (ChunkRef*)realloc(*chunks, capacity * sizeof(ChunkRef));
+      if (grown == NULL) {
+        free(*chunks);
+        *chunks = NULL;
+        return -1;
+      }
+      *chunks = grown;
+    }
+
+    size_t chunkLength = nextChunkBoundary(data + offset, length - offset);
+    (*chunks)[count].length = chunkLength;
+    sha256Hex(data + offset, chunkLength, (*chunks)[count].hash);
+    offset += chunkLength;
+    count++;
+  }
+  return count;
+}
+
+long chunkFile(FILE* file, ChunkRef** chunks, long* fileSize, uint32_t* crc) {
+  unsigned char* window = (unsigned char*)malloc(2 * CHUNK_MAX_SIZE);
+  if (window == NULL) {
+    perror("Memory allocation");
+    return -1;
+  }
+
+  size_t capacity = 0;
+  long count = 0;
+  size_t start = 0;
+  size_t filled = 0;
+  int eof = 0;
+  *chunks = NULL;
+  *fileSize = 0;
+  *crc = 0;
+
+  while (1) {
+    // Keep at least one maximum chunk ahead of the cut position, so that
+    // boundaries are the same as if the whole file were in memory
+    if (!eof && filled - start < CHUNK_MAX_SIZE) {
+      memmove(window, window + start, filled - start);
+      filled -= start;
+      start = 0;
+      while (!eof && filled < 2 * CHUNK_MAX_SIZE) {
+        size_t bytesRead = fread(window + filled, 1, 2 * CHUNK_MAX_SIZE - filled, file);
+        if (bytesRead == 0) {
+          if (ferror(file)) {
+            perror("fread");
+            free(window);
+            free(*chunks);
+            *chunks = NULL;
+            return -1;
+          }
+          eof = 1;
+        }
+        *crc = crc32cUpdate(*crc, window + filled, bytesRead);
+        filled += bytesRead;
+        *fileSize += bytesRead;
+      }
+    }
+    if (start == filled) {
+      break;
+    }
+
+    if ((size_t)count == capacity) {
+      capacity = capacity == 0 ? 64 : capacity * 2;
+      ChunkRef* grown = (ChunkRef*)realloc(*chunks, capacity * sizeof(ChunkRef));
+      if (grown == NULL) {
+        perror("Memory allocation");
+        free(window);
+        free(*chunks);
+        *chunks = NULL;
+        return -1;
+      }
+      *chunks = grown;
+    }
+
+    size_t chunkLength = nextChunkBoundary(window + start, filled - start);
+    (*chunks)[count].length = chunkLength;
+    sha256Hex(window + start, chunkLength, (*chunks)[count].hash);
+    start += chunkLength;
+    count++;
+  }
+
+  free(window);
+  return count;
+}
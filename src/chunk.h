@@ -0,0 +1,60 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sha256.h"
+
+// Content-defined chunk sizes. Boundaries depend only on the bytes around
+// them, so an insertion early in a file does not shift every later chunk.
+#define CHUNK_MIN_SIZE (2 * 1024)
+#define CHUNK_AVG_SIZE (8 * 1024)
+#define CHUNK_MAX_SIZE (64 * 1024)
+
+/**
+ * A chunk identified by the SHA-256 of its content.
+*/
+typedef struct {
+  char hash[SHA256_HEX_LENGTH + 1];
+  size_t length;
+} ChunkRef;
+
+/**
+ * @brief Finds the end of the next content-defined chunk using a gear
+ * rolling hash with normalized chunking.
+ *
+ * @param data The remaining, not yet chunked bytes.
+ * @param length The number of bytes in data.
+ * @return The length of the next chunk, never more than length.
+*/
+size_t nextChunkBoundary(const unsigned char* data, size_t length);
+
+/**
+ * @brief Splits a buffer into content-defined chunks and hashes each one.
+ *
+ * @param data The bytes to split.
+ * @param length The number of bytes in data.
+ * @param chunks Receives a malloc'd array of chunk references, NULL when
+ * the buffer is empty. The caller frees it.
+ * @return The number of chunks, or -1 on allocation failure.
+*/
+long chunkBuffer(const unsigned char* data, size_t length, ChunkRef** chunks);
+
+/**
+ * @brief Splits a file into content-defined chunks while reading it once
+ * through a window of two maximum chunk sizes, and computes its checksum on
+ * the way. The chunks are the same as chunkBuffer would find for the whole
+ * file, but only the chunk list is kept in memory.
+ *
+ * @param file The file, read from its current position.
+ * @param chunks Receives a malloc'd array of chunk references, which the
+ * caller frees.
+ * @param fileSize Receives the number of bytes read.
+ * @param crc Receives the CRC32C of the file.
+ * @return The number of chunks, or -1 on error.
+*/
+long chunkFile(FILE* file, ChunkRef** chunks, long* fileSize, uint32_t* crc);
+
+#endif
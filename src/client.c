@@ -8,48 +8,382 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "chunk.h"
+#include "crc32c.h"
+
 #define MAX_COMMAND_LENGTH 256
 #define MAX_RESPONSE_LENGTH 4096
-
-void send_file(int clientSocket, const char* filename) {
-  FILE* file = fopen(filename, "r");
+#define FILE_BUFFER_SIZE 65536
+
+/**
+ * @brief Receives exactly size bytes of file content and writes them to a
+ * file, computing their checksum on the way. If the file cannot be written
+ * the content is still received so that the connection stays in sync.
+ *
+ * @param clientSocket The socket connected to the server.
+ * @param filename The file to write.
+ * @param size The number of bytes the server announced.
+ * @param crc Receives the CRC32C of the received bytes.
+ * @return 0 on success, -1 if the file could not be written, -2 if the
+ * connection failed.
+*/
+int receive_file(int clientSocket, const char* filename, long size, uint32_t* crc) {
+  FILE* file = fopen(filename, "w");
   if (file == NULL) {
     perror("fopen");
-    return;
   }
 
-  char buffer[MAX_RESPONSE_LENGTH];
-  ssize_t bytesRead;
+  char buffer[FILE_BUFFER_SIZE];
+  long remaining = size;
+  int result = file != NULL ? 0 : -1;
+  *crc = 0;
 
-  // Read the file contents and send them to the server
-  while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0) {
-    if (send(clientSocket, buffer, bytesRead, 0) == -1) {
-      perror("Send");
+  // Receive file data from the server and write it to the file
+  while (remaining > 0) {
+    size_t want = remaining < (long)sizeof(buffer) ? (size_t)remaining : sizeof(buffer);
+    ssize_t bytesRead = recv(clientSocket, buffer, want, 0);
+    if (bytesRead <= 0) {
+      perror("Receive");
+      result = -2;
       break;
     }
+    *crc = crc32cUpdate(*crc, buffer, bytesRead);
+    if (result == 0 && fwrite(buffer, 1, bytesRead, file) != (size_t)bytesRead) {
+      perror("fwrite");
+      result = -1;
+    }
+    remaining -= bytesRead;
+  }
+
+  if (file != NULL && fclose(file) != 0 && result == 0) {
+    perror("fclose");
+    result = -1;
+  }
+  return result;
+}
+
+/**
+ * @brief Computes the checksum of a local file.
+ *
+ * @return 0 on success, -1 if the file cannot be read.
+*/
+int file_checksum(const char* filename, uint32_t* crc) {
+  FILE* file = fopen(filename, "r");
+  if (file == NULL) {
+    return -1;
   }
 
+  char buffer[FILE_BUFFER_SIZE];
+  size_t bytesRead;
+  *crc = 0;
+  while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    *crc = crc32cUpdate(*crc, buffer, bytesRead);
+  }
+  int result = ferror(file) ? -1 : 0;
   fclose(file);
+  return result;
 }
 
-void receive_file(int clientSocket, const char* filename) {
-  FILE* file = fopen(filename, "w");
+/**
+ * @brief Sends the whole buffer, retrying on partial sends.
+ *
+ * @return 0 on success, -1 on error.
+*/
+int send_all(int clientSocket, const void* data, size_t length) {
+  size_t sent = 0;
+  while (sent < length) {
+    ssize_t n = send(clientSocket, (const char*)data + sent, length - sent, 0);
+    if (n < 0) {
+      perror("Send");
+      return -1;
+    }
+    sent += n;
+  }
+  return 0;
+}
+
+/**
+ * @brief Receives one server response up to its EOT delimiter.
+ *
+ * @return The malloc'd, NUL-terminated response without the delimiter, or
+ * NULL on error.
+*/
+char* receive_response(int clientSocket) {
+  const char EOT = 4;
+  size_t capacity = MAX_RESPONSE_LENGTH;
+  size_t length = 0;
+  char* response = (char*)malloc(capacity);
+  if (response == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+
+  while (length == 0 || response[length - 1] != EOT) {
+    if (length == capacity - 1) {
+      capacity *= 2;
+      char* grown = (char*)realloc(response, capacity);
+      if (grown == NULL) {
+        perror("realloc");
+        free(response);
+        return NULL;
+      }
+      response = grown;
+    }
+
+    // Peek first so that a following response stays in the socket
+    ssize_t bytesRead = recv(clientSocket, response + length, capacity - 1 - length, MSG_PEEK);
+    if (bytesRead > 0) {
+      char* end = memchr(response + length, EOT, bytesRead);
+      if (end != NULL) {
+        bytesRead = end - (response + length) + 1;
+      }
+      bytesRead = recv(clientSocket, response + length, bytesRead, 0);
+    }
+    if (bytesRead <= 0) {
+      perror("Receive");
+      free(response);
+      return NULL;
+    }
+    length += bytesRead;
+  }
+
+  response[length - 1] = '\0';
+  return response;
+}
+
+/**
+ * @brief Receives the header of a "Get" response, which ends with the 
+ * "Size: <n> bytes" line and an empty line, or a whole response without
+ * content such as "Unchanged" or "ERROR", which ends with EOT. Nothing after
+ * that is taken from the socket.
+ *
+ * @param clientSocket The socket connected to the server.
+ * @param header The output buffer, NUL-terminated without the EOT.
+ * @param size The size of header.
+ * @return 1 for a file header, 0 for a response without content, -1 on
+ * error.
+*/
+int receive_header(int clientSocket, char* header, size_t size) {
+  const char EOT = 4;
+  const char* end = " bytes\n\n";
+  size_t endLength = strlen(end);
+  size_t length = 0;
+
+  while (length < size - 1) {
+    // Peek first so that the file content stays in the socket
+    ssize_t bytesRead = recv(clientSocket, header + length, size - 1 - length, MSG_PEEK);
+    if (bytesRead <= 0) {
+      perror("Receive");
+      return -1;
+    }
+
+    for (ssize_t i = 0; i < bytesRead; i++) {
+      size_t total = length + i + 1;
+      int isEot = header[total - 1] == EOT;
+      int isEnd = total >= endLength && memcmp(header + total - endLength, end, endLength) == 0;
+      if (isEot || isEnd) {
+        if (recv(clientSocket, header + length, i + 1, 0) != i + 1) {
+          perror("Receive");
+          return -1;
+        }
+        header[isEot ? total - 1 : total] = '\0';
+        return isEot ? 0 : 1;
+      }
+    }
+
+    if (recv(clientSocket, header + length, bytesRead, 0) != bytesRead) {
+      perror("Receive");
+      return -1;
+    }
+    length += bytesRead;
+  }
+
+  fprintf(stderr, "Response header too long\n");
+  return -1;
+}
+
+/**
+ * @brief Downloads a file with "Get" and verifies it. If a local copy
+ * exists its checksum is sent along, and the server answers "Unchanged"
+ * instead of sending a file the client already has. Otherwise the content
+ * is written to "<filename>.part" while its checksum is computed, compared
+ * with the checksum trailer that follows the content, and only then renamed
+ * to filename.
+ *
+ * @param clientSocket The socket connected to the server.
+ * @param filename The file to download.
+ * @return void.
+*/
+void get_file(int clientSocket, const char* filename) {
+  char command[MAX_COMMAND_LENGTH];
+  uint32_t localCrc;
+  if (file_checksum(filename, &localCrc) == 0) {
+    snprintf(command, sizeof(command), "Get %s %08x", filename, localCrc);
+  } else {
+    snprintf(command, sizeof(command), "Get %s", filename);
+  }
+  if (send_all(clientSocket, command, strlen(command)) < 0) {
+    return;
+  }
+
+  char header[MAX_RESPONSE_LENGTH];
+  int kind = receive_header(clientSocket, header, sizeof(header));
+  if (kind <= 0) {
+    if (kind == 0) {
+      printf("Response: %s\n", header);
+    }
+    return;
+  }
+  printf("Response: %s", header);
+
+  const char* sizeLine = strstr(header, "\nSize: ");
+  long size;
+  if (sizeLine == NULL || sscanf(sizeLine, "\nSize: %ld bytes", &size) != 1 || size < 0) {
+    fprintf(stderr, "Malformed response header\n");
+    return;
+  }
+
+  char partPath[MAX_COMMAND_LENGTH + 8];
+  snprintf(partPath, sizeof(partPath), "%s.part", filename);
+  uint32_t crc;
+  int result = receive_file(clientSocket, partPath, size, &crc);
+  if (result == -2) {
+    unlink(partPath);
+    return;
+  }
+
+  // The checksum the server computed while sending follows the content
+  char* trailer = receive_response(clientSocket);
+  unsigned int serverCrc;
+  if (trailer != NULL && strncmp(trailer, "\nERROR", 6) == 0) {
+    // The server noticed the content was not what it should have been
+    fprintf(stderr, "Response: %s, discarding %s\n", trailer + 1, partPath);
+    unlink(partPath);
+  } else if (trailer == NULL || sscanf(trailer, "\nCRC32C: %8x", &serverCrc) != 1) {
+    fprintf(stderr, "Missing checksum, discarding %s\n", partPath);
+    unlink(partPath);
+  } else if (serverCrc != crc) {
+    fprintf(stderr, "Checksum mismatch (received %08x, server sent %08x), discarding %s\n",
+            crc, serverCrc, partPath);
+    unlink(partPath);
+  } else if (result == 0 && rename(partPath, filename) == 0) {
+    printf("Saved %s (%ld bytes, CRC32C %08x verified)\n", filename, size, crc);
+  } else {
+    perror(filename);
+    unlink(partPath);
+  }
+  free(trailer);
+}
+
+/**
+ * @brief Uploads a file with the deduplicating "Chunks" command. The file
+ * is split into content-defined chunks, the server is told their hashes and
+ * only the chunks it reports as missing are sent, each read again from the
+ * file when it is sent. The checksum of the file is announced with the 
+ * chunk list and compared with the one the server confirms. Names the
+ * command cannot carry are refused before anything is sent.
+ *
+ * @param clientSocket The socket connected to the server.
+ * @param filename The file to upload.
+ * @return void.
+*/
+void put_file(int clientSocket, const char* filename) {
+  // The server reads the name up to the first blank, so a name with blanks
+  // would split the command and the chunk list would be taken for commands
+  if (filename[0] == '\0' || filename[strcspn(filename, " \t")] != '\0') {
+    fprintf(stderr, "Invalid filename: %s\n", filename);
+    return;
+  }
+
+  FILE* file = fopen(filename, "r");
   if (file == NULL) {
     perror("fopen");
     return;
   }
 
-  char buffer[MAX_RESPONSE_LENGTH];
-  ssize_t bytesRead;
+  ChunkRef* chunks;
+  long fileSize;
+  uint32_t crc;
+  long count = chunkFile(file, &chunks, &fileSize, &crc);
+  if (count < 0) {
+    fclose(file);
+    return;
+  }
 
-  // Receive file data from the server and write it to the file
-  while ((bytesRead = recv(clientSocket, buffer, sizeof(buffer), 0)) > 0) {
-    if (fwrite(buffer, 1, bytesRead, file) != (size_t)bytesRead) {
-      perror("fwrite");
-      break;
+  // Announce the chunk list: "Chunks <filename> <count> <crc32c>" and one
+  // "<hash> <length>" line per chunk, sent a buffer at a time
+  char buffer[CHUNK_MAX_SIZE];
+  char* reply = NULL;
+  size_t length = snprintf(buffer, sizeof(buffer), "Chunks %s %ld %08x\n", filename, count, crc);
+  for (long i = 0; i < count; i++) {
+    if (length > sizeof(buffer) - (SHA256_HEX_LENGTH + 24)) {
+      if (send_all(clientSocket, buffer, length) < 0) {
+        goto cleanup;
+      }
+      length = 0;
     }
+    length += sprintf(buffer + length, "%s %zu\n", chunks[i].hash, chunks[i].length);
+  }
+  if (send_all(clientSocket, buffer, length) < 0 ||
+      (reply = receive_response(clientSocket)) == NULL) {
+    goto cleanup;
+  }
+
+  long numNeeded;
+  int consumed;
+  if (sscanf(reply, "Need %ld%n", &numNeeded, &consumed) != 1) {
+    printf("Response: %s\n", reply);
+    goto cleanup;
+  }
+
+  // Send the requested chunks back to back in index order
+  const char* next = reply + consumed;
+  off_t offset = 0;
+  long sentChunks = 0;
+  long wanted = numNeeded > 0 ? strtol(next, (char**)&next, 10) : -1;
+  size_t sentBytes = 0;
+  for (long i = 0; i < count && sentChunks < numNeeded; i++) {
+    if (i == wanted) {
+      ssize_t bytesRead = pread(fileno(file), buffer, chunks[i].length, offset);
+      if (bytesRead != (ssize_t)chunks[i].length) {
+        fprintf(stderr, "%s changed while uploading\n", filename);
+        break;
+      }
+      if (send_all(clientSocket, buffer, chunks[i].length) < 0) {
+        break;
+      }
+      sentBytes += chunks[i].length;
+      if (++sentChunks < numNeeded) {
+        wanted = strtol(next, (char**)&next, 10);
+      }
+    }
+    offset += chunks[i].length;
+  }
+  printf("Uploaded %zu of %ld bytes (%ld of %ld chunks)\n", sentBytes, fileSize, sentChunks, count);
+  if (sentChunks < numNeeded) {
+    goto cleanup;
   }
 
+  // The confirmation carries the checksum of what the server stored
+  free(reply);
+  reply = receive_response(clientSocket);
+  if (reply == NULL) {
+    goto cleanup;
+  }
+  printf("Response: %s\n", reply);
+  const char* confirmed = strstr(reply, "CRC32C: ");
+  unsigned int serverCrc;
+  if (confirmed != NULL && sscanf(confirmed, "CRC32C: %8x", &serverCrc) == 1) {
+    if (serverCrc == crc) {
+      printf("CRC32C %08x verified\n", crc);
+    } else {
+      printf("Checksum mismatch: local %08x, server %08x\n", crc, serverCrc);
+    }
+  }
+
+cleanup:
+  free(reply);
+  free(chunks);
   fclose(file);
 }
 
@@ -158,8 +492,15 @@ int main(int argc, char** argv) {
         continue;
       }
 
-      // Send the command to the server
-      if (send(clientSocket, command, strlen(command), 0) < 0) {
+      if (strncmp(command, "Put ", 4) == 0) {
+        // Uploads first negotiate which chunks the server lacks
+        const char* filename = command + 4; // Extract the filename from the command
+        put_file(clientSocket, filename);
+      } else if (strncmp(command, "Get ", 4) == 0) {
+        // Downloads are saved to a file and verified
+        get_file(clientSocket, command + 4);
+      } else if (send(clientSocket, command, strlen(command), 0) < 0) {
+        // Send the command to the server
         perror("Send");
         break;
       }
@@ -171,17 +512,6 @@ int main(int argc, char** argv) {
         printf("Disconnecting from the server.\n");
         break;
       }
-
-      // Check if the command is "Put <filename>" to send a file to the server
-      if (strncmp(command, "Put ", 4) == 0) {
-        const char* filename = command + 4; // Extract the filename from the command
-        send_file(clientSocket, filename);
-      }
-
-      if (strncmp(command, "Get ", 4) == 0) {
-        // Extract the filename from the command
-        const char* filename = command + 4;
-      }
     }
 
     // Check if there is input from the server
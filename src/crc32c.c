@@ -0,0 +1,143 @@
+#include "crc32c.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32C_X86 1
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+#define CRC32C_ARM 1
+#endif
+
+// Reflected Castagnoli polynomial
+#define CRC32C_POLYNOMIAL 0x82f63b78
+
+typedef uint32_t (*Crc32cFunction)(uint32_t crc, const unsigned char* data, size_t length);
+
+static uint32_t table[8][256];
+static Crc32cFunction implementation = NULL;
+static const char* implementationName = "software";
+
+static void initTable(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0 - (crc & 1)));
+    }
+    table[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; i++) {
+    for (int k = 1; k < 8; k++) {
+      table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+    }
+  }
+}
+
+/**
+ * @brief Slicing-by-8: folds eight input bytes per step with eight lookups.
+*/
+static uint32_t crc32cSoftware(uint32_t crc, const unsigned char* data, size_t length) {
+  while (length >= 8) {
+    uint32_t low = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 |
+                          (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+    crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^
+          table[5][(low >> 16) & 0xff] ^ table[4][low >> 24] ^
+          table[3][data[4]] ^ table[2][data[5]] ^ table[1][data[6]] ^ table[0][data[7]];
+    data += 8;
+    length -= 8;
+  }
+  while (length-- > 0) {
+    crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xff];
+  }
+  return crc;
+}
+
+#if CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(uint32_t crc, const unsigned char* data, size_t length) {
+  uint64_t crc64 = crc;
+  while (length >= 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+    data += 8;
+    length -= 8;
+  }
+  crc = (uint32_t)crc64;
+  while (length-- > 0) {
+    crc = _mm_crc32_u8(crc, *data++);
+  }
+  return crc;
+}
+
+static int hardwareAvailable(void) {
+  return __builtin_cpu_supports("sse4.2");
+}
+#elif CRC32C_ARM
+#if defined(__clang__)
+__attribute__((target("crc")))
+#else
+__attribute__((target("+crc")))
+#endif
+static uint32_t crc32cHardware(uint32_t crc, const unsigned char* data, size_t length) {
+  while (length >= 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc = __crc32cd(crc, word);
+    data += 8;
+    length -= 8;
+  }
+  while (length-- > 0) {
+    crc = __crc32cb(crc, *data++);
+  }
+  return crc;
+}
+
+static int hardwareAvailable(void) {
+#if defined(__linux__)
+  return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+  // Every 64-bit Apple CPU has the CRC instructions
+  return 1;
+#endif
+}
+#endif
+
+static void selectImplementation(void) {
+#if CRC32C_X86
+  if (hardwareAvailable()) {
+    implementationName = "sse4.2";
+    implementation = crc32cHardware;
+    return;
+  }
+#elif CRC32C_ARM
+  if (hardwareAvailable()) {
+    implementationName = "armv8";
+    implementation = crc32cHardware;
+    return;
+  }
+#endif
+  initTable();
+  implementation = crc32cSoftware;
+}
+
+uint32_t crc32cUpdate(uint32_t crc, const void* data, size_t length) {
+  if (implementation == NULL) {
+    selectImplementation();
+  }
+  return ~implementation(~crc, (const unsigned char*)data, length);
+}
+
+const char* crc32cImplementation(void) {
+  if (implementation == NULL) {
+    selectImplementation();
+  }
+  return implementationName;
+}
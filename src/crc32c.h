@@ -0,0 +1,29 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Length of a checksum written as "%08x"
+#define CRC32C_HEX_LENGTH 8
+
+/**
+ * @brief Extends a CRC32C (Castagnoli) checksum by length bytes. Start
+ * with crc = 0; feeding a stream in pieces gives the same result as
+ * feeding it at once. Uses the SSE4.2 or ARMv8 CRC instructions when the
+ * CPU has them and a table driven implementation otherwise.
+ *
+ * @param crc The checksum of the data so far.
+ * @param data The next bytes.
+ * @param length The number of bytes in data.
+ * @return The checksum including data.
+*/
+uint32_t crc32cUpdate(uint32_t crc, const void* data, size_t length);
+
+/**
+ * @return The name of the implementation in use: "sse4.2", "armv8" or
+ * "software".
+*/
+const char* crc32cImplementation(void);
+
+#endif
@@ -0,0 +1,1068 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/select.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "crc32c.h"
+#include "handlers.h"
+
+#define MAX_CHUNKS (1024 * 1024)
+#define TRANSFER_TIMEOUT_SEC 5
+#define PUT_IDLE_TIMEOUT_SEC 1
+#define UPLOAD_BUFFER_SIZE 65536
+// Longest "<hash> <length>" line of a chunk list
+#define CHUNK_LIST_LINE_LENGTH (SHA256_HEX_LENGTH + 24)
+// Sidecar directory caching the checksums of the files in the server directory
+#define CHECKSUM_DIRECTORY ".checksums"
+// Temporary files of uploads in progress are named
+// <filename>.upload<server pid>.<client socket>
+#define UPLOAD_SUFFIX ".upload"
+
+/**
+ * Store client hostname and port number.
+*/
+typedef struct {
+  char hostname[256];
+  int port;
+} ClientInfo;
+
+/**
+ * @brief Queues a response for the client, followed by the EOT delimiter
+ * that marks its end. The scheduler sends it in chunks alongside the
+ * output of the other clients.
+ * 
+ * @param client The client connection which receives the response.
+ * @param response The response message to be sent to the client.
+ * @return void.
+ * 
+*/
+void responseToClientInChunk(Connection* client, const char* response) {
+  const char EOT = 4;
+  queueAppend(&client->flow.output, response, strlen(response));
+  queueAppend(&client->flow.output, &EOT, sizeof(EOT));
+}
+
+/**
+ * @brief etrieves the client information of all connected sockets and 
+ * sends a response to the client with the list of connected clients.
+ * 
+ * @param client The client connection which receives the response.
+ * @param clientsSockets The array of the connected client sockets.
+ * @return void
+*/
+void handleListCommand(Connection* client, int* clientSockets) {
+  // Create an array to store the client information
+  ClientInfo clients[MAX_CLIENTS];
+  int numClients = 0;
+
+  // Loop through all connected sockets and get client information
+  for (int i = 0; i < MAX_CLIENTS; i++) {
+    if (clientSockets[i] != -1) {
+      struct sockaddr_in clientAddr;
+      unsigned int addrLen = sizeof(clientAddr);
+      getpeername(clientSockets[i], (struct sockaddr*)&clientAddr, &addrLen);
+
+      // Store client hostname and port in the array
+      strcpy(clients[numClients].hostname, inet_ntoa(clientAddr.sin_addr));
+      clients[numClients].port = ntohs(clientAddr.sin_port);
+      numClients++;
+    }
+  }
+
+  // Create the response string
+  char response[MAX_RESPONSE_LENGTH];
+  sprintf(response, "Connected Clients:\n");
+  for (int i = 0; i < numClients; i++) {
+      char clientInfo[sizeof(clients[i].hostname) + 16];
+      snprintf(clientInfo, sizeof(clientInfo), "%.255s:%d\n", clients[i].hostname, clients[i].port);
+      strcat(response, clientInfo);
+  }
+  sprintf(response + strlen(response), "Total Clients: %d", numClients);
+
+  // Send the response to the client in chunks
+  responseToClientInChunk(client, response);
+}
+
+/**
+ * @brief Checks whether a directory entry is the temporary file of an upload
+ * in progress, or one left behind by a server that was stopped.
+*/
+static int isUploadFile(const char* name) {
+  const char* suffix = NULL;
+  for (const char* next = strstr(name, UPLOAD_SUFFIX); next != NULL; next = strstr(next + 1, UPLOAD_SUFFIX)) {
+    suffix = next;
+  }
+  long pid;
+  int socket;
+  int length = 0;
+  return suffix != NULL && suffix != name &&
+         sscanf(suffix, UPLOAD_SUFFIX "%ld.%d%n", &pid, &socket, &length) == 2 && suffix[length] == '\0';
+}
+
+/**
+ * @brief retrieves the list of files in the server directory and 
+ * sends a response to the client with the file names and their attributes.
+ * Files kept in the chunk store are listed after the directory entries.
+ * 
+ * @param client The client connection which receives the response.
+ * @param store The chunk store, or NULL if deduplication is disabled.
+ * @return void.
+*/
+void handleFilesCommand(Connection* client, const ChunkStore* store) {
+  // Open the server directory
+  DIR* dir;
+  struct dirent* entry;
+  struct stat fileStat;
+  char fileAttributes[256];
+  int numFiles = 0;
+
+  dir = opendir(".");
+  if (dir == NULL) {
+    perror("opendir");
+    return;
+  }
+
+  // Prepare the response string
+  char response[4096] = "List of Files:\n";
+
+  // Read directory entries and get file information
+  while ((entry = readdir(dir)) != NULL) {
+    // Neither the checksum cache nor unfinished uploads are served files
+    if (strcmp(entry->d_name, CHECKSUM_DIRECTORY) == 0 || isUploadFile(entry->d_name)) {
+      continue;
+    }
+    if (stat(entry->d_name, &fileStat) < 0) {
+      perror("stat");
+      continue;
+    }
+
+    // Format the file attributes
+    strftime(fileAttributes, sizeof(fileAttributes), "%Y-%m-%d %H:%M:%S", localtime(&fileStat.st_mtime));
+
+    // Append the filename and attributes to the response string
+    snprintf(response + strlen(response), sizeof(response) - strlen(response), "%s\t%s\n", entry->d_name, fileAttributes);
+
+    numFiles++;
+  }
+  closedir(dir);
+
+  // Append the files kept in the chunk store
+  if (store != NULL && (dir = storeOpenManifests(store)) != NULL) {
+    while ((entry = readdir(dir)) != NULL) {
+      if (!storeValidName(entry->d_name) || storeStatFile(store, entry->d_name, &fileStat) < 0) {
+        continue;
+      }
+
+      strftime(fileAttributes, sizeof(fileAttributes), "%Y-%m-%d %H:%M:%S", localtime(&fileStat.st_mtime));
+      snprintf(response + strlen(response), sizeof(response) - strlen(response), "%s\t%s\n", entry->d_name, fileAttributes);
+
+      numFiles++;
+    }
+    closedir(dir);
+  }
+
+  // Send the response to the client in chunks
+  responseToClientInChunk(client, response);
+}
+
+/**
+ * @brief Builds the path of the cached checksum of a file. Only files that
+ * could also be stored in the chunk store are cached.
+ *
+ * @return 0 on success, -1 if the file cannot have a cached checksum.
+*/
+static int checksumPath(char* path, size_t size, const char* filename) {
+  if (!storeValidName(filename)) {
+    return -1;
+  }
+  int length = snprintf(path, size, "%s/%s", CHECKSUM_DIRECTORY, filename);
+  return length < 0 || (size_t)length >= size ? -1 : 0;
+}
+
+/**
+ * @brief Looks up the cached checksum of a file in the server directory.
+ * The entry is only used while the size and modification time of the file
+ * are those it was computed for.
+ *
+ * @param filename The file.
+ * @param fileStat The current attributes of the file.
+ * @param crc Receives the checksum.
+ * @return 1 if a valid checksum was found, 0 otherwise.
+*/
+static int loadChecksum(const char* filename, const struct stat* fileStat, uint32_t* crc) {
+  char path[STORE_PATH_LENGTH];
+  if (checksumPath(path, sizeof(path), filename) < 0) {
+    return 0;
+  }
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    return 0;
+  }
+
+  long long size, seconds, nanoseconds;
+  unsigned int checksum;
+  int valid = fscanf(file, "%lld %lld %lld %8x", &size, &seconds, &nanoseconds, &checksum) == 4 &&
+              size == (long long)fileStat->st_size &&
+              seconds == (long long)fileStat->st_mtime &&
+              nanoseconds == (long long)STAT_MTIME_NSEC(fileStat);
+  fclose(file);
+  if (valid) {
+    *crc = checksum;
+  }
+  return valid;
+}
+
+/**
+ * @brief Caches the checksum of a file in the server directory, next to the
+ * attributes of the file it belongs to. Failures only cost a recompute.
+*/
+static void saveChecksum(const char* filename, const struct stat* fileStat, uint32_t crc) {
+  char path[STORE_PATH_LENGTH];
+  char tmpPath[STORE_PATH_LENGTH + 8];
+  if (checksumPath(path, sizeof(path), filename) < 0) {
+    return;
+  }
+  if (mkdir(CHECKSUM_DIRECTORY, 0755) < 0 && errno != EEXIST) {
+    perror(CHECKSUM_DIRECTORY);
+    return;
+  }
+
+  // Write a temporary file and rename it so readers never see half an entry
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+  FILE* file = fopen(tmpPath, "w");
+  if (file == NULL) {
+    perror(tmpPath);
+    return;
+  }
+  fprintf(file, "%lld %lld %lld %08x\n", (long long)fileStat->st_size,
+          (long long)fileStat->st_mtime, (long long)STAT_MTIME_NSEC(fileStat), crc);
+  if (fclose(file) != 0 || rename(tmpPath, path) < 0) {
+    perror(path);
+    unlink(tmpPath);
+  }
+}
+
+/**
+ * The file whose checksum a Get computes while streaming it: a file in the
+ * server directory, or in the chunk store if store is set. fileStat is the
+ * version of the file that is sent.
+*/
+typedef struct {
+  char filename[256];
+  struct stat fileStat;
+  const ChunkStore* store;
+} ChecksumTarget;
+
+static void cacheStreamedChecksum(void* context, uint32_t crc) {
+  ChecksumTarget* target = (ChecksumTarget*)context;
+  if (target->store != NULL) {
+    storeSetChecksum(target->store, target->filename, &target->fileStat, crc);
+  } else {
+    saveChecksum(target->filename, &target->fileStat, crc);
+  }
+}
+
+/**
+ * @brief handles the "Get <filename> [crc32c]" command from the client. It
+ * extracts the filename from the command and queues a response with the 
+ * file information followed by the file content, which is streamed from 
+ * disk as the client's share of the bandwidth allows, and a 
+ * "\nCRC32C: xxxxxxxx" trailer computed while the content is sent. Files 
+ * kept in the chunk store are streamed chunk by chunk.
+ * 
+ * If the client sends the checksum of its own copy and the server knows the
+ * checksum of the file without reading it, from the manifest or the 
+ * checksum cache, a matching file is answered with "Unchanged" instead.
+ * A file that is sent anyway is checked against the known checksum. If
+ * they differ, the response ends with "ERROR Checksum mismatch" instead of
+ * a checksum, and the cached entry is replaced by the checksum computed
+ * while streaming, as it is whenever no checksum was known.
+ * 
+ * @param client The client connection which receives the response.
+ * @param store The chunk store, or NULL if deduplication is disabled.
+ * @return void.
+*/
+void handleGetCommand(Connection* client, const char* command, const ChunkStore* store) {
+  // Parse the command to extract the filename and file attributes
+  char filename[256];
+  char fileAttributes[256];
+  unsigned int clientCrc = 0;
+  int fields = sscanf(command, "Get %255s %255[^\n]", filename, fileAttributes);
+  if (fields < 1) {
+    responseToClientInChunk(client, "ERROR Missing filename");
+    return;
+  }
+  int hasClientCrc = fields == 2 && sscanf(fileAttributes, "%8x", &clientCrc) == 1;
+
+  const char EOT = 4;
+  struct stat fileStat;
+  ChunkRef* chunks = NULL;
+  long count = 0;
+  int fd = -1;
+  long fileSize = 0;
+  uint32_t crc = 0;
+  int hasCrc = 0;
+  int stored = store != NULL && storeStatFile(store, filename, &fileStat) == 0;
+
+  if (stored) {
+    // Only the first line of the manifest is needed to skip the download
+    if (hasClientCrc && storeReadChecksum(store, filename, &crc) && crc == clientCrc) {
+      hasCrc = 1;
+    } else {
+      chunks = storeReadManifest(store, filename, &count, &crc, &hasCrc);
+    }
+    if (count < 0) {
+      responseToClientInChunk(client, "ERROR File not readable");
+      return;
+    }
+    for (long i = 0; i < count; i++) {
+      fileSize += chunks[i].length;
+    }
+  } else {
+    // Open the file for reading
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+      perror("File open");
+      responseToClientInChunk(client, "ERROR File not found");
+      return;
+    }
+
+    // Get the size and the last modified time of the file
+    if (fstat(fd, &fileStat) == -1) {
+      perror("File stat");
+      close(fd);
+      responseToClientInChunk(client, "ERROR File not readable");
+      return;
+    }
+    if (!S_ISREG(fileStat.st_mode)) {
+      close(fd);
+      responseToClientInChunk(client, "ERROR Not a regular file");
+      return;
+    }
+    fileSize = fileStat.st_size;
+    hasCrc = loadChecksum(filename, &fileStat, &crc);
+  }
+
+  char response[MAX_RESPONSE_LENGTH];
+  if (hasCrc && hasClientCrc && crc == clientCrc) {
+    // The client already has this file
+    if (fd >= 0) {
+      close(fd);
+    }
+    free(chunks);
+    snprintf(response, sizeof(response), "Unchanged %s\nCRC32C: %08x", filename, crc);
+    responseToClientInChunk(client, response);
+    return;
+  }
+  time_t lastModified = fileStat.st_mtime;
+
+  // Queue the file attributes, then the content and its checksum
+  snprintf(response, sizeof(response), "Filename: %s\nLast Modified: %s\nSize: %ld bytes\n\n",
+           filename, ctime(&lastModified), fileSize);
+  queueAppend(&client->flow.output, response, strlen(response));
+
+  if (fd >= 0) {
+    queueAppendFile(&client->flow.output, fd, fileSize);
+  }
+  for (long i = 0; i < count; i++) {
+    char path[STORE_PATH_LENGTH];
+    if (storeChunkPath(store, chunks[i].hash, path) == 0) {
+      queueAppendPath(&client->flow.output, path, chunks[i].length);
+    }
+  }
+  free(chunks);
+
+  // Cache the streamed checksum so the next Get of an unchanged file can
+  // be answered without sending it
+  ChecksumTarget* target = NULL;
+  if (storeValidName(filename)) {
+    target = (ChecksumTarget*)malloc(sizeof(ChecksumTarget));
+    if (target != NULL) {
+      snprintf(target->filename, sizeof(target->filename), "%s", filename);
+      target->fileStat = fileStat;
+      target->store = stored ? store : NULL;
+    }
+  }
+  queueAppendChecksum(&client->flow.output, hasCrc ? &crc : NULL,
+                      target != NULL ? cacheStreamedChecksum : NULL, target);
+
+  queueAppend(&client->flow.output, &EOT, sizeof(EOT));
+}
+
+/**
+ * @brief Sends the response to a completed upload with the server 
+ * hostname, IP address, current date and time and the checksum of what
+ * the server received, so the client can compare it with its own.
+ * 
+ * @param client The client connection which receives the response.
+ * @param checksum The CRC32C of the uploaded file, NULL if not known.
+ * @return void.
+*/
+static void sendPutConfirmation(Connection* client, const uint32_t* checksum) {
+  // Get the server hostname and IP address
+  char hostname[256];
+  if (gethostname(hostname, sizeof(hostname)) < 0) {
+    perror("gethostname");
+    return;
+  }
+
+  struct addrinfo hints, *serverInfo;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if (getaddrinfo(hostname, NULL, &hints, &serverInfo) != 0) {
+    perror("getaddrinfo");
+    return;
+  }
+
+  char serverIP[INET6_ADDRSTRLEN];
+  void* serverAddr;
+  if (serverInfo->ai_family == AF_INET) {
+    // IPv4
+    struct sockaddr_in* ipv4 = (struct sockaddr_in*)serverInfo->ai_addr;
+    serverAddr = &(ipv4->sin_addr);
+    if (inet_ntop(AF_INET, serverAddr, serverIP, sizeof(serverIP)) == NULL) {
+      perror("inet_ntop");
+      freeaddrinfo(serverInfo);
+      return;
+    }
+  } else {
+    // IPv6
+    struct sockaddr_in6* ipv6 = (struct sockaddr_in6*)serverInfo->ai_addr;
+    serverAddr = &(ipv6->sin6_addr);
+    if (inet_ntop(AF_INET6, serverAddr, serverIP, sizeof(serverIP)) == NULL) {
+      perror("inet_ntop");
+      freeaddrinfo(serverInfo);
+      return;
+    }
+  }
+
+  freeaddrinfo(serverInfo);
+
+  // Get the current date and time
+  time_t rawTime;
+  struct tm* timeInfo;
+  time(&rawTime);
+  timeInfo = localtime(&rawTime);
+  if (timeInfo == NULL) {
+    perror("localtime");
+    return;
+  }
+  char datetime[64];
+  strftime(datetime, sizeof(datetime), "%Y-%m-%d %H:%M:%S", timeInfo);
+
+  // Send the response to the client in chunks
+  char response[MAX_RESPONSE_LENGTH];
+  int length = snprintf(response, sizeof(response), "OK %s\n%s\n%s", hostname, serverIP, datetime);
+  if (checksum != NULL && length >= 0 && (size_t)length < sizeof(response)) {
+    snprintf(response + length, sizeof(response) - length, "\nCRC32C: %08x", *checksum);
+  }
+  responseToClientInChunk(client, response);
+}
+
+/**
+ * @brief Releases everything an upload holds and returns the connection
+ * to waiting for commands.
+*/
+static void resetUpload(Connection* client) {
+  Upload* upload = &client->upload;
+  if (upload->file != NULL) {
+    fclose(upload->file);
+  }
+  free(upload->chunks);
+  free(upload->needed);
+  free(upload->list);
+  free(upload->buffer);
+  memset(upload, 0, sizeof(*upload));
+  client->state = CONNECTION_IDLE;
+}
+
+/**
+ * @brief Ends an unfinished upload. The partially received data is
+ * removed and any existing file of the same name is left untouched.
+*/
+static void abortUpload(Connection* client) {
+  Upload* upload = &client->upload;
+  if (upload->file != NULL) {
+    fclose(upload->file);
+    upload->file = NULL;
+    unlink(upload->tmpPath);
+  }
+  resetUpload(client);
+}
+
+/**
+ * @brief Creates the temporary file an upload to the server directory is
+ * written to, next to its final name so that it can be renamed over it.
+ * Other clients keep reading the previous version until then.
+ *
+ * @return 0 on success, -1 on error.
+*/
+static int openUploadFile(Connection* client) {
+  Upload* upload = &client->upload;
+  snprintf(upload->tmpPath, sizeof(upload->tmpPath), "%s" UPLOAD_SUFFIX "%ld.%d",
+           upload->filename, (long)getpid(), client->flow.socket);
+  upload->file = fopen(upload->tmpPath, "w");
+  if (upload->file == NULL) {
+    perror("File open");
+    return -1;
+  }
+  return 0;
+}
+
+void connectionInit(Connection* client, int socket, double rate, size_t quantum) {
+  flowInit(&client->flow, socket, rate, quantum);
+  memset(&client->upload, 0, sizeof(client->upload));
+  client->state = CONNECTION_IDLE;
+  client->deadline = 0;
+  client->closing = 0;
+}
+
+void connectionClose(Connection* client) {
+  abortUpload(client);
+  queueClear(&client->flow.output);
+  close(client->flow.socket);
+  client->flow.socket = -1;
+}
+
+/**
+ * @brief handles the "Put" command from the client. It creates a temporary
+ * file in the server directory; the file data is then written by 
+ * handleUploadData as it arrives. Once the client has been silent for 
+ * PUT_IDLE_TIMEOUT_SEC seconds, checkUploadTimeout moves the file into 
+ * place, replacing any stored version, and sends a response to the client
+ * with the server hostname, IP address, current date and time and the 
+ * checksum of the received data. A plain Put has no length, so comparing 
+ * that checksum is the only way for the client to notice a truncated upload.
+ * 
+ * @param client The client connection which receives the response.
+ * @param command The command.
+ * @return void.
+*/
+void handlePutCommand(Connection* client, const char* command) {
+  // Extract the filename from the command
+  const char* filename = command + 4;
+  snprintf(client->upload.filename, sizeof(client->upload.filename), "%s", filename);
+
+  // Create a new file in the server directory
+  if (openUploadFile(client) < 0) {
+    resetUpload(client);
+    return;
+  }
+  client->state = CONNECTION_PUT;
+  client->deadline = monotonicNow() + PUT_IDLE_TIMEOUT_SEC;
+}
+
+typedef struct {
+  const char* hash;
+  long index;
+} HashIndex;
+
+static int compareHashIndex(const void* a, const void* b) {
+  const HashIndex* x = (const HashIndex*)a;
+  const HashIndex* y = (const HashIndex*)b;
+  int cmp = strcmp(x->hash, y->hash);
+  if (cmp != 0) {
+    return cmp;
+  }
+  return (x->index > y->index) - (x->index < y->index);
+}
+
+/**
+ * @brief Decides which chunks of a list the client has to upload: the
+ * first occurrence of every hash that is not stored yet.
+ * 
+ * @param store The chunk store.
+ * @param chunks The chunk list.
+ * @param count The number of chunks.
+ * @param needed Receives 1 for every chunk that must be uploaded.
+ * @return 0 on success, -1 on allocation failure.
+*/
+static int findMissingChunks(const ChunkStore* store, const ChunkRef* chunks, long count, char* needed) {
+  HashIndex* sorted = (HashIndex*)malloc((count > 0 ? count : 1) * sizeof(HashIndex));
+  if (sorted == NULL) {
+    perror("Memory allocation");
+    return -1;
+  }
+  for (long i = 0; i < count; i++) {
+    sorted[i].hash = chunks[i].hash;
+    sorted[i].index = i;
+  }
+  qsort(sorted, count, sizeof(HashIndex), compareHashIndex);
+
+  for (long i = 0; i < count; i++) {
+    if (i > 0 && strcmp(sorted[i].hash, sorted[i - 1].hash) == 0) {
+      needed[sorted[i].index] = 0;
+    } else {
+      needed[sorted[i].index] = !storeHasChunk(store, sorted[i].hash);
+    }
+  }
+
+  free(sorted);
+  return 0;
+}
+
+/**
+ * @brief Closes the file of a completed upload to the server directory,
+ * moves it to its final name and caches the checksum computed while it was
+ * written. On failure the temporary file is removed.
+ *
+ * @return 0 on success, -1 if the file could not be written.
+*/
+static int closeUploadedFile(Upload* upload) {
+  int result = fclose(upload->file) == 0 ? 0 : -1;
+  upload->file = NULL;
+  if (result == 0 && rename(upload->tmpPath, upload->filename) < 0) {
+    perror(upload->filename);
+    result = -1;
+  }
+  if (result < 0) {
+    unlink(upload->tmpPath);
+    return -1;
+  }
+
+  struct stat fileStat;
+  if (stat(upload->filename, &fileStat) == 0) {
+    saveChecksum(upload->filename, &fileStat, upload->crc);
+  }
+  return 0;
+}
+
+static void finishChunkUpload(Connection* client, const ChunkStore* store) {
+  Upload* upload = &client->upload;
+  int failed = upload->failed;
+  uint32_t crc = upload->crc;
+
+  // The checksum covers the whole file only if every chunk was sent
+  int hasCrc = 1;
+  for (long i = 0; i < upload->count; i++) {
+    hasCrc = hasCrc && upload->needed[i];
+  }
+  int mismatch = !failed && hasCrc && upload->hasExpectedCrc && crc != upload->expectedCrc;
+  if (mismatch) {
+    fprintf(stderr, "Checksum mismatch for %s\n", upload->filename);
+    failed = 1;
+  }
+
+  if (upload->file != NULL) {
+    if (failed) {
+      fclose(upload->file);
+      upload->file = NULL;
+      unlink(upload->tmpPath);
+    } else {
+      failed = closeUploadedFile(upload) < 0;
+    }
+  } else if (!failed) {
+    // If chunks the store already had were skipped, the first Get computes
+    // the checksum instead
+    failed = storeWriteManifest(store, upload->filename, upload->chunks, upload->count,
+                                hasCrc ? &crc : NULL) < 0;
+  }
+
+  resetUpload(client);
+  if (mismatch) {
+    responseToClientInChunk(client, "ERROR Checksum mismatch");
+  } else if (failed) {
+    responseToClientInChunk(client, "ERROR Upload failed");
+  } else {
+    sendPutConfirmation(client, hasCrc ? &crc : NULL);
+  }
+}
+
+/**
+ * @brief Moves on to the next chunk the client has to send, finishing the
+ * upload after the last one.
+*/
+static void nextNeededChunk(Connection* client, const ChunkStore* store) {
+  Upload* upload = &client->upload;
+  do {
+    upload->current++;
+  } while (upload->current < upload->count && !upload->needed[upload->current]);
+  upload->bufferLength = 0;
+
+  if (upload->current == upload->count) {
+    finishChunkUpload(client, store);
+  }
+}
+
+/**
+ * @brief Verifies a completely received chunk and stores it, or appends it
+ * to the file without a chunk store. After a failure the remaining chunks 
+ * are still received, so that the connection stays in sync, but dropped.
+*/
+static void storeReceivedChunk(Connection* client, const ChunkStore* store) {
+  Upload* upload = &client->upload;
+  const ChunkRef* chunk = &upload->chunks[upload->current];
+
+  if (!upload->failed) {
+    if (store != NULL) {
+      upload->failed = storePutChunk(store, chunk, upload->buffer) < 0;
+    } else {
+      char hash[SHA256_HEX_LENGTH + 1];
+      sha256Hex(upload->buffer, chunk->length, hash);
+      upload->failed = strcmp(hash, chunk->hash) != 0 ||
+                       fwrite(upload->buffer, 1, chunk->length, upload->file) != chunk->length;
+    }
+    upload->crc = crc32cUpdate(upload->crc, upload->buffer, chunk->length);
+  }
+  nextNeededChunk(client, store);
+}
+
+/**
+ * @brief Called once the whole chunk list has arrived. Decides which 
+ * chunks to request, answers "Need <k> <i>..." and waits for the chunks.
+*/
+static void startChunkData(Connection* client, const ChunkStore* store) {
+  Upload* upload = &client->upload;
+  long count = upload->count;
+
+  free(upload->list);
+  upload->list = NULL;
+  upload->needed = (char*)malloc(count > 0 ? count : 1);
+  upload->buffer = (unsigned char*)malloc(CHUNK_MAX_SIZE);
+  char* response = (char*)malloc(32 + (size_t)count * 21);
+  int failed = upload->needed == NULL || upload->buffer == NULL || response == NULL;
+
+  // Decide which chunks to request
+  if (!failed) {
+    if (store != NULL) {
+      failed = findMissingChunks(store, upload->chunks, count, upload->needed) < 0;
+    } else {
+      for (long i = 0; i < count; i++) {
+        upload->needed[i] = 1;
+      }
+      failed = openUploadFile(client) < 0;
+    }
+  }
+  if (failed) {
+    free(response);
+    resetUpload(client);
+    responseToClientInChunk(client, "ERROR Upload rejected");
+    return;
+  }
+
+  long numNeeded = 0;
+  for (long i = 0; i < count; i++) {
+    numNeeded += upload->needed[i];
+  }
+  size_t length = sprintf(response, "Need %ld", numNeeded);
+  for (long i = 0; i < count; i++) {
+    if (upload->needed[i]) {
+      length += sprintf(response + length, " %ld", i);
+    }
+  }
+  responseToClientInChunk(client, response);
+  free(response);
+
+  client->state = CONNECTION_CHUNK_DATA;
+  upload->current = -1;
+  nextNeededChunk(client, store);
+}
+
+/**
+ * @brief Grows a buffer of the upload to hold at least needed elements.
+ *
+ * @return 0 on success, -1 on allocation failure.
+*/
+static int growUploadBuffer(void** buffer, size_t* capacity, size_t needed, size_t elementSize) {
+  if (needed <= *capacity) {
+    return 0;
+  }
+  size_t grown = *capacity > 0 ? *capacity : 64;
+  while (grown < needed) {
+    grown *= 2;
+  }
+  void* resized = realloc(*buffer, grown * elementSize);
+  if (resized == NULL) {
+    perror("Memory allocation");
+    return -1;
+  }
+  *buffer = resized;
+  *capacity = grown;
+  return 0;
+}
+
+/**
+ * @brief Parses one "<hash> <length>" line of the chunk list into the next
+ * entry of the chunk array.
+ *
+ * @return NULL on success, or the error reply that rejects the list.
+*/
+static const char* parseChunkListLine(Upload* upload, const char* line, const char* end) {
+  if (growUploadBuffer((void**)&upload->chunks, &upload->chunksCapacity,
+                       (size_t)upload->parsed + 1, sizeof(ChunkRef)) < 0) {
+    return "ERROR Upload rejected";
+  }
+
+  ChunkRef* chunk = &upload->chunks[upload->parsed];
+  int consumed = 0;
+  if (sscanf(line, "%64s %zu%n", chunk->hash, &chunk->length, &consumed) != 2 ||
+      !storeValidHash(chunk->hash) ||
+      chunk->length == 0 || chunk->length > CHUNK_MAX_SIZE ||
+      line + consumed != end) {
+    fprintf(stderr, "Malformed chunk list entry\n");
+    return "ERROR Invalid chunk list";
+  }
+  return NULL;
+}
+
+/**
+ * @brief Counts the lines of a rejected chunk list without keeping them.
+*/
+static void skipChunkList(Upload* upload, const char* data, size_t length) {
+  const char* end = data + length;
+  while (upload->parsed < upload->count && (data = memchr(data, '\n', end - data)) != NULL) {
+    data++;
+    upload->parsed++;
+  }
+}
+
+/**
+ * @brief Appends received text to the chunk list and parses every line
+ * that is complete. The client sends nothing else until it has seen the
+ * reply, so the list is never followed by other data. Parsed lines are
+ * dropped, so the buffer only holds what arrived since the last complete
+ * line, and the chunk array grows with the lines actually received rather
+ * than the count the client claims. A rejected list is still received to
+ * its last line before the error is sent, so that its remaining lines are
+ * not taken for commands.
+*/
+static void appendChunkList(Connection* client, const ChunkStore* store, const char* data, size_t length) {
+  Upload* upload = &client->upload;
+  if (upload->rejection == NULL &&
+      growUploadBuffer((void**)&upload->list, &upload->listCapacity,
+                       upload->listLength + length + 1, 1) < 0) {
+    upload->rejection = "ERROR Upload rejected";
+  }
+
+  if (upload->rejection != NULL) {
+    skipChunkList(upload, data, length);
+  } else {
+    memcpy(upload->list + upload->listLength, data, length);
+    upload->listLength += length;
+
+    size_t offset = 0;
+    while (upload->rejection == NULL && upload->parsed < upload->count) {
+      char* line = upload->list + offset;
+      char* end = memchr(line, '\n', upload->listLength - offset);
+      if (end == NULL) {
+        break;
+      }
+      *end = '\0';
+      upload->rejection = parseChunkListLine(upload, line, end);
+      upload->parsed++;
+      offset = end + 1 - upload->list;
+    }
+
+    if (upload->rejection != NULL) {
+      skipChunkList(upload, upload->list + offset, upload->listLength - offset);
+      upload->listLength = 0;
+    } else {
+      // Keep only the incomplete line and wait for the rest of it
+      upload->listLength -= offset;
+      memmove(upload->list, upload->list + offset, upload->listLength);
+      if (upload->parsed < upload->count && upload->listLength > CHUNK_LIST_LINE_LENGTH) {
+        fprintf(stderr, "Chunk list line too long\n");
+        upload->rejection = "ERROR Invalid chunk list";
+        upload->listLength = 0;
+      }
+    }
+  }
+
+  if (upload->parsed < upload->count) {
+    return;
+  }
+  if (upload->rejection != NULL) {
+    const char* error = upload->rejection;
+    resetUpload(client);
+    responseToClientInChunk(client, error);
+    return;
+  }
+  startChunkData(client, store);
+}
+
+/**
+ * @brief handles the "Chunks <filename> <count> [crc32c]" command, the 
+ * deduplicating upload. The command is followed by one "<hash> <length>" 
+ * line per content-defined chunk of the file. The optional checksum of the
+ * whole file is verified against the received data whenever every chunk is
+ * sent. The server answers "Need <k> <i>..." 
+ * with the indices of the chunks it lacks, receives exactly those chunks 
+ * back to back and verifies each against its hash. Without a chunk store 
+ * every chunk is requested and the file is written to the server directory.
+ * The list and the chunks are received by handleUploadData as they arrive.
+ * A command without a usable count closes the connection, since there is
+ * no telling where its list ends.
+ * 
+ * @param client The client connection which sends the file.
+ * @param command The command including the first part of the chunk list.
+ * @param store The chunk store, or NULL if deduplication is disabled.
+ * @return void.
+*/
+void handleChunksCommand(Connection* client, const char* command, const ChunkStore* store) {
+  Upload* upload = &client->upload;
+  long count;
+  unsigned int crc = 0;
+
+  // Parse the first line only, the chunk list follows it
+  char header[MAX_COMMAND_LENGTH];
+  snprintf(header, sizeof(header), "%.*s", (int)strcspn(command, "\n"), command);
+  int fields = sscanf(header, "Chunks %255s %ld %8x", upload->filename, &count, &crc);
+  if (fields < 2 || count < 0 || count > MAX_CHUNKS) {
+    responseToClientInChunk(client, "ERROR Invalid chunk list");
+    client->closing = 1;
+    return;
+  }
+  upload->expectedCrc = crc;
+  upload->hasExpectedCrc = fields == 3;
+  if (store != NULL && !storeValidName(upload->filename)) {
+    upload->rejection = "ERROR Invalid filename";
+  }
+
+  // The list and the chunk array grow as the list arrives
+  upload->count = count;
+  client->state = CONNECTION_CHUNK_LIST;
+  client->deadline = monotonicNow() + TRANSFER_TIMEOUT_SEC;
+
+  // The first part of the list may have arrived together with the command
+  const char* listStart = strchr(command, '\n');
+  listStart = listStart != NULL ? listStart + 1 : "";
+  appendChunkList(client, store, listStart, strlen(listStart));
+}
+
+int handleUploadData(Connection* client, const ChunkStore* store, size_t budget) {
+  Upload* upload = &client->upload;
+  char buffer[UPLOAD_BUFFER_SIZE];
+  char* target = buffer;
+  size_t want = budget < sizeof(buffer) ? budget : sizeof(buffer);
+
+  if (client->state == CONNECTION_CHUNK_DATA) {
+    // Receive straight into the chunk buffer and never past the current
+    // chunk, so that a command sent right after the upload stays queued
+    size_t missing = upload->chunks[upload->current].length - upload->bufferLength;
+    target = (char*)upload->buffer + upload->bufferLength;
+    if (want > missing) {
+      want = missing;
+    }
+  }
+
+  ssize_t bytesRead = recv(client->flow.socket, target, want, 0);
+  if (bytesRead < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return 0;
+    }
+    perror("Receive");
+    return -1;
+  }
+  if (bytesRead == 0) {
+    return -1;
+  }
+
+  client->deadline = monotonicNow() +
+                     (client->state == CONNECTION_PUT ? PUT_IDLE_TIMEOUT_SEC : TRANSFER_TIMEOUT_SEC);
+  switch (client->state) {
+    case CONNECTION_PUT:
+      // Keep draining the upload after a failed write, the client is only
+      // told once it has finished sending
+      if (!upload->failed && fwrite(buffer, 1, bytesRead, upload->file) != (size_t)bytesRead) {
+        perror(upload->tmpPath);
+        upload->failed = 1;
+      }
+      upload->crc = crc32cUpdate(upload->crc, buffer, bytesRead);
+      break;
+    case CONNECTION_CHUNK_LIST:
+      appendChunkList(client, store, buffer, bytesRead);
+      break;
+    case CONNECTION_CHUNK_DATA:
+      upload->bufferLength += bytesRead;
+      if (upload->bufferLength == upload->chunks[upload->current].length) {
+        storeReceivedChunk(client, store);
+      }
+      break;
+    case CONNECTION_IDLE:
+      break;
+  }
+  return 0;
+}
+
+void checkUploadTimeout(Connection* client, const ChunkStore* store, double now) {
+  if (client->state == CONNECTION_IDLE || now < client->deadline) {
+    return;
+  }
+
+  if (client->state == CONNECTION_PUT) {
+    // The client has stopped sending, the plain upload is complete and
+    // replaces any stored version of the same file
+    uint32_t crc = client->upload.crc;
+    int failed = client->upload.failed;
+    if (failed) {
+      abortUpload(client);
+    } else {
+      failed = closeUploadedFile(&client->upload) < 0;
+    }
+    if (!failed && store != NULL && storeValidName(client->upload.filename)) {
+      storeRemoveFile(store, client->upload.filename);
+    }
+    resetUpload(client);
+    if (failed) {
+      responseToClientInChunk(client, "ERROR Upload failed");
+    } else {
+      sendPutConfirmation(client, &crc);
+    }
+  } else {
+    fprintf(stderr, "Transfer timed out\n");
+    abortUpload(client);
+    responseToClientInChunk(client, "ERROR Upload timed out");
+  }
+}
+
+/**
+ * @brief The function handleCommand is called to handle the client command based on its type. 
+ * It dispatches the command to the appropriate handler function.
+ * 
+ * @param client the client connection which receives the response.
+ * @param clientSockets the list of the connected client sockets.
+ * @param response the response message to be sent to the client.
+ * @param store the chunk store, or NULL if deduplication is disabled.
+ * @return void.
+*/
+void handleCommand(Connection* client, int* clientSockets, const char* command, const ChunkStore* store) {
+  if (strcmp(command, "List") == 0) {
+    handleListCommand(client, clientSockets);
+  }
+  else if (strncmp(command, "Files", 5) == 0) {
+    handleFilesCommand(client, store);
+  }
+  else if (strncmp(command, "Get", 3) == 0) {
+    handleGetCommand(client, command, store);
+  }
+  else if (strncmp(command, "Put", 3) == 0) {
+    handlePutCommand(client, command);
+  }
+  else if (strncmp(command, "Chunks", 6) == 0) {
+    handleChunksCommand(client, command, store);
+  }
+  else if (strncmp(command, "Quit", 4) == 0) {
+    // Client requested to quit. The server closes the connection once
+    // everything queued for it has been sent.
+    printf("Client requested to quit. Closing connection.\n");
+    client->closing = 1;
+  }
+  else {
+    // Invalid command received, force the client to send the right command
+    const char* response = "Invalid command. Please send a valid command (List, Files, Get <filename> [crc32c], Put <filename>, Chunks <filename> <count> [crc32c])";
+    responseToClientInChunk(client, response);
+  }
+}
@@ -0,0 +1,100 @@
+#ifndef HANDLERS_H
+#define HANDLERS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "scheduler.h"
+#include "store.h"
+
+#define MAX_RESPONSE_LENGTH 4096
+#define MAX_COMMAND_LENGTH 256
+#define MAX_CLIENTS 10
+
+/**
+ * What a connection is doing. Uploads are received a piece at a time by
+ * handleUploadData so that one client's upload does not stall the others.
+*/
+typedef enum {
+  CONNECTION_IDLE,
+  CONNECTION_PUT,
+  CONNECTION_CHUNK_LIST,
+  CONNECTION_CHUNK_DATA
+} ConnectionState;
+
+/**
+ * State of an upload in progress. Data is written to tmpPath, which only
+ * replaces filename once the upload is complete. crc is the CRC32C of the
+ * data written so far; expectedCrc is the checksum the client announced,
+ * if hasExpectedCrc is set. rejection is the error reply to a chunk list
+ * that is dropped while the rest of it arrives.
+*/
+typedef struct {
+  char filename[256];
+  char tmpPath[300];
+  FILE* file;
+  ChunkRef* chunks;
+  size_t chunksCapacity;
+  long count;
+  char* needed;
+  char* list;
+  size_t listLength;
+  size_t listCapacity;
+  long parsed;
+  long current;
+  unsigned char* buffer;
+  size_t bufferLength;
+  uint32_t crc;
+  uint32_t expectedCrc;
+  int hasExpectedCrc;
+  int failed;
+  const char* rejection;
+} Upload;
+
+/**
+ * A connected client: its scheduled output and the upload it is sending.
+ * deadline is when the current upload times out. A closing connection
+ * no longer reads commands and is closed once its output has been sent.
+*/
+typedef struct {
+  Flow flow;
+  ConnectionState state;
+  double deadline;
+  int closing;
+  Upload upload;
+} Connection;
+
+// Command handlers of the server. They are built into a static library so
+// that the server binary and the benchmarks share the same code; see
+// handlers.c for the documentation of each handler. Handlers only queue
+// output, which the scheduler then sends.
+
+void connectionInit(Connection* client, int socket, double rate, size_t quantum);
+
+/**
+ * @brief Aborts any upload, drops queued output and closes the socket.
+*/
+void connectionClose(Connection* client);
+
+void responseToClientInChunk(Connection* client, const char* response);
+void handleListCommand(Connection* client, int* clientSockets);
+void handleFilesCommand(Connection* client, const ChunkStore* store);
+void handleGetCommand(Connection* client, const char* command, const ChunkStore* store);
+void handlePutCommand(Connection* client, const char* command);
+void handleChunksCommand(Connection* client, const char* command, const ChunkStore* store);
+void handleCommand(Connection* client, int* clientSockets, const char* command, const ChunkStore* store);
+
+/**
+ * @brief Receives up to budget bytes of the upload in progress.
+ *
+ * @return 0 on success, -1 if the connection was closed or failed.
+*/
+int handleUploadData(Connection* client, const ChunkStore* store, size_t budget);
+
+/**
+ * @brief Completes a plain "Put" once the client has gone silent, or fails
+ * a chunked upload that stalled.
+*/
+void checkUploadTimeout(Connection* client, const ChunkStore* store, double now);
+
+#endif
@@ -0,0 +1,394 @@
+#include "scheduler.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define FILE_BUFFER_SIZE 65536
+// Rate limited flows may burst up to this many seconds worth of bytes
+#define BURST_SECONDS 0.1
+
+double monotonicNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t minSize(size_t a, size_t b) {
+  return a < b ? a : b;
+}
+
+void queueInit(OutputQueue* queue) {
+  queue->head = NULL;
+  queue->tail = NULL;
+  queue->pending = 0;
+  queue->crc = 0;
+}
+
+static void queuePush(OutputQueue* queue, Segment* segment) {
+  segment->next = NULL;
+  if (queue->tail == NULL) {
+    queue->head = segment;
+  } else {
+    queue->tail->next = segment;
+  }
+  queue->tail = segment;
+  queue->pending += segment->length;
+}
+
+static void freeSegment(Segment* segment) {
+  if (segment->fd >= 0) {
+    close(segment->fd);
+  }
+  free(segment->data);
+  free(segment->path);
+  free(segment->checksumContext);
+  free(segment);
+}
+
+static void queuePop(OutputQueue* queue) {
+  Segment* segment = queue->head;
+  queue->head = segment->next;
+  if (queue->head == NULL) {
+    queue->tail = NULL;
+  }
+  queue->pending -= segment->length;
+  freeSegment(segment);
+}
+
+int queueAppend(OutputQueue* queue, const void* data, size_t length) {
+  if (length == 0) {
+    return 0;
+  }
+
+  Segment* segment = (Segment*)calloc(1, sizeof(Segment));
+  if (segment == NULL || (segment->data = (char*)malloc(length)) == NULL) {
+    perror("Memory allocation");
+    free(segment);
+    return -1;
+  }
+  memcpy(segment->data, data, length);
+  segment->length = length;
+  segment->fd = -1;
+  queuePush(queue, segment);
+  return 0;
+}
+
+int queueAppendFile(OutputQueue* queue, int fd, size_t length) {
+  if (length == 0) {
+    close(fd);
+    return 0;
+  }
+
+  Segment* segment = (Segment*)calloc(1, sizeof(Segment));
+  if (segment == NULL) {
+    perror("Memory allocation");
+    close(fd);
+    return -1;
+  }
+  segment->length = length;
+  segment->fd = fd;
+  queuePush(queue, segment);
+  return 0;
+}
+
+int queueAppendPath(OutputQueue* queue, const char* path, size_t length) {
+  if (length == 0) {
+    return 0;
+  }
+
+  Segment* segment = (Segment*)calloc(1, sizeof(Segment));
+  if (segment == NULL || (segment->path = strdup(path)) == NULL) {
+    perror("Memory allocation");
+    free(segment);
+    return -1;
+  }
+  segment->length = length;
+  segment->fd = -1;
+  queuePush(queue, segment);
+  return 0;
+}
+
+int queueAppendChecksum(OutputQueue* queue, const uint32_t* expected, ChecksumCallback done,
+                        void* context) {
+  Segment* segment = (Segment*)calloc(1, sizeof(Segment));
+  if (segment == NULL) {
+    perror("Memory allocation");
+    free(context);
+    return -1;
+  }
+  segment->length = CHECKSUM_TRAILER_LENGTH;
+  segment->fd = -1;
+  segment->checksum = 1;
+  if (expected != NULL) {
+    segment->hasExpected = 1;
+    segment->expected = *expected;
+  }
+  segment->checksumDone = done;
+  segment->checksumContext = context;
+  queuePush(queue, segment);
+  return 0;
+}
+
+/**
+ * @brief Turns a checksum trailer that reached the head of the queue into a
+ * memory segment and starts the checksum of the next file. Content that
+ * does not have the expected checksum gets an error instead of the trailer,
+ * which keeps the response in sync since the content itself was complete.
+*/
+static int finishChecksum(OutputQueue* queue, Segment* segment) {
+  char trailer[sizeof(CHECKSUM_MISMATCH_REPLY)];
+  int mismatch = segment->hasExpected && queue->crc != segment->expected;
+  if (mismatch) {
+    fprintf(stderr, "Checksum mismatch: sent %08x, expected %08x\n", queue->crc, segment->expected);
+    snprintf(trailer, sizeof(trailer), "%s", CHECKSUM_MISMATCH_REPLY);
+  } else {
+    snprintf(trailer, sizeof(trailer), "\nCRC32C: %08x", queue->crc);
+  }
+  segment->data = strdup(trailer);
+  if (segment->data == NULL) {
+    perror("Memory allocation");
+    return -1;
+  }
+  size_t length = strlen(trailer);
+  queue->pending = queue->pending - segment->length + length;
+  segment->length = length;
+
+  if (segment->checksumDone != NULL && (!segment->hasExpected || mismatch)) {
+    segment->checksumDone(segment->checksumContext, queue->crc);
+  }
+  queue->crc = 0;
+  return 0;
+}
+
+ssize_t queueSend(OutputQueue* queue, int socket, size_t budget) {
+  char buffer[FILE_BUFFER_SIZE];
+  size_t total = 0;
+
+  while (queue->head != NULL && total < budget) {
+    Segment* segment = queue->head;
+    if (segment->checksum && segment->data == NULL && finishChecksum(queue, segment) < 0) {
+      return -1;
+    }
+    size_t want = minSize(segment->length, budget - total);
+    ssize_t sent;
+
+    if (segment->data != NULL) {
+      sent = send(socket, segment->data + segment->offset, want, MSG_NOSIGNAL);
+    } else {
+      // Read the next piece of the file; whatever the socket does not take
+      // is read again next time
+      if (segment->fd < 0 && (segment->fd = open(segment->path, O_RDONLY)) < 0) {
+        perror(segment->path);
+        return -1;
+      }
+      want = minSize(want, sizeof(buffer));
+      ssize_t bytesRead = pread(segment->fd, buffer, want, segment->fileOffset);
+      if (bytesRead <= 0) {
+        fprintf(stderr, "Queued file became shorter than announced\n");
+        return -1;
+      }
+      want = bytesRead;
+      sent = send(socket, buffer, want, MSG_NOSIGNAL);
+      if (sent > 0) {
+        queue->crc = crc32cUpdate(queue->crc, buffer, sent);
+      }
+    }
+
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        break;
+      }
+      perror("Send");
+      return -1;
+    }
+
+    segment->offset += sent;
+    segment->fileOffset += sent;
+    segment->length -= sent;
+    queue->pending -= sent;
+    total += sent;
+    if (segment->length == 0) {
+      queuePop(queue);
+    } else if ((size_t)sent < want) {
+      // The socket buffer is full
+      break;
+    }
+  }
+  return total;
+}
+
+int queueFlush(OutputQueue* queue, int socket) {
+  while (queue->pending > 0) {
+    ssize_t sent = queueSend(queue, socket, (size_t)-1);
+    if (sent < 0) {
+      return -1;
+    }
+    if (sent == 0) {
+      fd_set write_fds;
+      FD_ZERO(&write_fds);
+      FD_SET(socket, &write_fds);
+      if (select(socket + 1, NULL, &write_fds, NULL, NULL) < 0) {
+        perror("Select");
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+void queueClear(OutputQueue* queue) {
+  while (queue->head != NULL) {
+    queuePop(queue);
+  }
+  queue->crc = 0;
+}
+
+void bucketInit(TokenBucket* bucket, double rate, double burst) {
+  bucket->rate = rate;
+  bucket->burst = burst < 1 ? 1 : burst;
+  bucket->tokens = bucket->burst;
+  bucket->last = monotonicNow();
+}
+
+size_t bucketAvailable(TokenBucket* bucket, double now) {
+  if (bucket->rate <= 0) {
+    return (size_t)-1;
+  }
+
+  bucket->tokens += (now - bucket->last) * bucket->rate;
+  if (bucket->tokens > bucket->burst) {
+    bucket->tokens = bucket->burst;
+  }
+  bucket->last = now;
+  return bucket->tokens >= 1 ? (size_t)bucket->tokens : 0;
+}
+
+void bucketConsume(TokenBucket* bucket, size_t bytes) {
+  if (bucket->rate > 0) {
+    bucket->tokens -= bytes;
+  }
+}
+
+double bucketDelay(const TokenBucket* bucket, size_t bytes) {
+  if (bucket->rate <= 0 || bucket->tokens >= bytes) {
+    return 0;
+  }
+  return (bytes - bucket->tokens) / bucket->rate;
+}
+
+static double burstFor(double rate, size_t quantum) {
+  double burst = rate * BURST_SECONDS;
+  return burst > quantum ? burst : quantum;
+}
+
+void flowInit(Flow* flow, int socket, double rate, size_t quantum) {
+  flow->socket = socket;
+  queueInit(&flow->output);
+  flow->deficit = 0;
+  bucketInit(&flow->bucket, rate, burstFor(rate, quantum));
+  flow->failed = 0;
+}
+
+void schedulerInit(Scheduler* scheduler, size_t quantum, double globalRate) {
+  scheduler->quantum = quantum;
+  bucketInit(&scheduler->global, globalRate, burstFor(globalRate, quantum));
+  scheduler->next = 0;
+}
+
+/**
+ * @brief The number of tokens a flow waits for before it is worth sending:
+ * a full quantum, or less if that is all it has queued. This keeps rate
+ * limited flows from waking up for every single byte.
+*/
+static size_t readyThreshold(const Scheduler* scheduler, const Flow* flow) {
+  size_t threshold = minSize(flow->output.pending, scheduler->quantum);
+  if (flow->bucket.rate > 0) {
+    threshold = minSize(threshold, (size_t)flow->bucket.burst);
+  }
+  if (scheduler->global.rate > 0) {
+    threshold = minSize(threshold, (size_t)scheduler->global.burst);
+  }
+  return threshold;
+}
+
+int schedulerWantsWrite(Scheduler* scheduler, Flow* flow, double now) {
+  if (flow->failed || flow->output.pending == 0) {
+    return 0;
+  }
+  size_t threshold = readyThreshold(scheduler, flow);
+  return bucketAvailable(&flow->bucket, now) >= threshold &&
+         bucketAvailable(&scheduler->global, now) >= threshold;
+}
+
+void schedulerRound(Scheduler* scheduler, Flow** flows, int count, const fd_set* writable) {
+  if (count <= 0) {
+    return;
+  }
+
+  double now = monotonicNow();
+  // Rotate the starting flow so that none is always first in line for the
+  // global bucket
+  for (int k = 0; k < count; k++) {
+    Flow* flow = flows[(scheduler->next + k) % count];
+    if (flow == NULL || flow->failed || flow->output.pending == 0 ||
+        !FD_ISSET(flow->socket, writable)) {
+      continue;
+    }
+
+    flow->deficit += scheduler->quantum;
+    size_t budget = minSize(flow->deficit, flow->output.pending);
+    budget = minSize(budget, bucketAvailable(&flow->bucket, now));
+    budget = minSize(budget, bucketAvailable(&scheduler->global, now));
+
+    ssize_t sent = budget > 0 ? queueSend(&flow->output, flow->socket, budget) : 0;
+    if (sent < 0) {
+      flow->failed = 1;
+      continue;
+    }
+    bucketConsume(&flow->bucket, sent);
+    bucketConsume(&scheduler->global, sent);
+
+    // Carry over at most one quantum so that a flow held back by its rate
+    // limit or a full socket cannot build up a large burst
+    flow->deficit = minSize(flow->deficit - sent, scheduler->quantum);
+    if (flow->output.pending == 0) {
+      flow->deficit = 0;
+    }
+  }
+  scheduler->next = (scheduler->next + 1) % count;
+}
+
+double schedulerDelay(Scheduler* scheduler, Flow** flows, int count, double now) {
+  double delay = -1;
+  bucketAvailable(&scheduler->global, now);
+  for (int i = 0; i < count; i++) {
+    Flow* flow = flows[i];
+    if (flow == NULL || flow->failed || flow->output.pending == 0) {
+      continue;
+    }
+
+    bucketAvailable(&flow->bucket, now);
+    size_t threshold = readyThreshold(scheduler, flow);
+    double wait = bucketDelay(&flow->bucket, threshold);
+    double globalWait = bucketDelay(&scheduler->global, threshold);
+    if (globalWait > wait) {
+      wait = globalWait;
+    }
+    if (wait > 0 && (delay < 0 || wait < delay)) {
+      delay = wait;
+    }
+  }
+  return delay;
+}
@@ -0,0 +1,227 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/select.h>
+#include <sys/types.h>
+
+// "\nCRC32C: " followed by eight hex digits
+#define CHECKSUM_TRAILER_LENGTH 17
+// Sent instead of the trailer when the content did not have the checksum
+// it was expected to have
+#define CHECKSUM_MISMATCH_REPLY "\nERROR Checksum mismatch"
+
+/**
+ * Called when a checksum trailer is about to be sent, with the CRC32C of
+ * the file content queued before it, unless that is the checksum the
+ * content was expected to have. context is the pointer given to
+ * queueAppendChecksum.
+*/
+typedef void (*ChecksumCallback)(void* context, uint32_t crc);
+
+/**
+ * One piece of queued output: either an owned memory buffer, a byte range
+ * of a file or a checksum trailer. File segments given by path are opened
+ * only when they reach the head of the queue, so a long queue does not hold
+ * open files. A trailer's text is only known once the file content before
+ * it has been sent; if hasExpected is set, that content must match the
+ * checksum expected.
+*/
+typedef struct Segment {
+  struct Segment* next;
+  char* data;
+  size_t length;
+  size_t offset;
+  char* path;
+  int fd;
+  off_t fileOffset;
+  int checksum;
+  int hasExpected;
+  uint32_t expected;
+  ChecksumCallback checksumDone;
+  void* checksumContext;
+} Segment;
+
+/**
+ * Output waiting to be sent to one client. crc is the CRC32C of the file
+ * content sent since the last checksum trailer.
+*/
+typedef struct {
+  Segment* head;
+  Segment* tail;
+  size_t pending;
+  uint32_t crc;
+} OutputQueue;
+
+/**
+ * Token bucket rate limit in bytes per second. A rate of 0 means unlimited.
+*/
+typedef struct {
+  double rate;
+  double burst;
+  double tokens;
+  double last;
+} TokenBucket;
+
+/**
+ * A client as seen by the scheduler: its socket, queued output, deficit
+ * round robin counter and rate limit. failed is set when sending fails and
+ * the connection has to be closed.
+*/
+typedef struct {
+  int socket;
+  OutputQueue output;
+  size_t deficit;
+  TokenBucket bucket;
+  int failed;
+} Flow;
+
+/**
+ * Deficit round robin over all flows with queued output. Every round each
+ * writable flow may send up to quantum bytes plus what it could not use in
+ * earlier rounds, so small responses are not stuck behind bulk transfers.
+*/
+typedef struct {
+  size_t quantum;
+  TokenBucket global;
+  int next;
+} Scheduler;
+
+/**
+ * @return The time of a monotonic clock in seconds.
+*/
+double monotonicNow(void);
+
+void queueInit(OutputQueue* queue);
+
+/**
+ * @brief Appends a copy of a buffer to the queue.
+ *
+ * @return 0 on success, -1 on allocation failure.
+*/
+int queueAppend(OutputQueue* queue, const void* data, size_t length);
+
+/**
+ * @brief Appends length bytes of an open file, starting at its beginning.
+ * The queue takes ownership of fd.
+ *
+ * @return 0 on success, -1 on allocation failure.
+*/
+int queueAppendFile(OutputQueue* queue, int fd, size_t length);
+
+/**
+ * @brief Appends the first length bytes of the file at path, which is
+ * opened when the segment is about to be sent.
+ *
+ * @return 0 on success, -1 on allocation failure.
+*/
+int queueAppendPath(OutputQueue* queue, const char* path, size_t length);
+
+/**
+ * @brief Appends a checksum trailer, "\nCRC32C: xxxxxxxx", covering the
+ * file content queued since the previous trailer. The checksum is computed
+ * from the bytes as they are sent, so the file is read only once.
+ *
+ * @param queue The queue.
+ * @param expected The checksum the content is known to have, or NULL. If
+ * the sent content differs, CHECKSUM_MISMATCH_REPLY is sent instead of the
+ * trailer.
+ * @param done Called with the checksum when the trailer is reached if it is
+ * not the expected one, may be NULL. It is not called if the queue is
+ * cleared first.
+ * @param context A malloc'd argument for done, which the queue frees.
+ * @return 0 on success, -1 on allocation failure.
+*/
+int queueAppendChecksum(OutputQueue* queue, const uint32_t* expected, ChecksumCallback done,
+                        void* context);
+
+/**
+ * @brief Sends up to budget bytes from the head of the queue without
+ * blocking.
+ *
+ * @return The number of bytes sent, or -1 if the connection failed or a
+ * queued file could not be read.
+*/
+ssize_t queueSend(OutputQueue* queue, int socket, size_t budget);
+
+/**
+ * @brief Sends the whole queue, waiting for the socket whenever it is full.
+ *
+ * @return 0 on success, -1 on error.
+*/
+int queueFlush(OutputQueue* queue, int socket);
+
+/**
+ * @brief Drops all queued output and closes queued files.
+*/
+void queueClear(OutputQueue* queue);
+
+/**
+ * @brief Initializes a bucket that allows rate bytes per second with bursts
+ * of up to burst bytes. The bucket starts full.
+*/
+void bucketInit(TokenBucket* bucket, double rate, double burst);
+
+/**
+ * @brief Refills the bucket.
+ *
+ * @return The number of bytes that may be sent now, or (size_t)-1 if the
+ * bucket is unlimited.
+*/
+size_t bucketAvailable(TokenBucket* bucket, double now);
+
+void bucketConsume(TokenBucket* bucket, size_t bytes);
+
+/**
+ * @return Seconds until bytes may be sent, 0 if they may be sent now.
+*/
+double bucketDelay(const TokenBucket* bucket, size_t bytes);
+
+/**
+ * @brief Initializes a flow for a newly connected socket.
+ *
+ * @param flow The flow.
+ * @param socket The client socket.
+ * @param rate The send rate limit in bytes per second, 0 for unlimited.
+ * @param quantum The scheduler quantum, the smallest burst a limited flow
+ * is allowed.
+ * @return void.
+*/
+void flowInit(Flow* flow, int socket, double rate, size_t quantum);
+
+/**
+ * @brief Initializes the scheduler.
+ *
+ * @param scheduler The scheduler.
+ * @param quantum The bytes each flow may send per round.
+ * @param globalRate The total send rate in bytes per second, 0 for
+ * unlimited.
+*/
+void schedulerInit(Scheduler* scheduler, size_t quantum, double globalRate);
+
+/**
+ * @return 1 if the flow has output that the rate limits allow to be sent
+ * now, so its socket should be watched for writability.
+*/
+int schedulerWantsWrite(Scheduler* scheduler, Flow* flow, double now);
+
+/**
+ * @brief Runs one deficit round robin round over the flows whose sockets
+ * are writable. Flows that fail are marked in Flow.failed.
+ *
+ * @param scheduler The scheduler.
+ * @param flows The flows, NULL entries are skipped.
+ * @param count The number of entries in flows.
+ * @param writable The sockets select reported as writable.
+ * @return void.
+*/
+void schedulerRound(Scheduler* scheduler, Flow** flows, int count, const fd_set* writable);
+
+/**
+ * @return Seconds until a flow that is held back only by its rate limits
+ * may send again, or -1 if no flow is waiting for tokens.
+*/
+double schedulerDelay(Scheduler* scheduler, Flow** flows, int count, double now);
+
+#endif
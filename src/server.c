@@ -5,372 +5,74 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
-#include <stdlib.h>
 #include <sys/select.h>
-#include <dirent.h>
-#include <sys/stat.h>
-#include <time.h>
 #include <netdb.h>
+#include <fcntl.h>
+#include <stdlib.h>
+
+#include "handlers.h"
 
 #define DEFAULT_PORT 0
 #define CHUNK_SIZE 1024
-#define MAX_RESPONSE_LENGTH 4096
-#define MAX_COMMAND_LENGTH 256
-#define MAX_CLIENTS 10
+// Bytes each client may send and receive per scheduler round
+#define SEND_QUANTUM 16384
+#define RECEIVE_QUANTUM 65536
 
 /**
- * Store client hostname and port number.
-*/
-typedef struct {
-  char hostname[256];
-  int port;
-} ClientInfo;
-
-/**
- * @brief Sends a response to the client in chunks. It splits the response
- * into smaller chunks and sends them to the client.
+ * @brief Closes a client connection and removes it from the client array,
+ * the scheduler and the master set.
  * 
- * @param clientSocket The client socket which receives the response.
- * @param response The response message to be sent to the client.
+ * @param client The connection to close.
+ * @param clientSocket The client's entry in the client socket array.
+ * @param flow The client's entry in the scheduler's flow array.
+ * @param master The set of sockets watched by select.
  * @return void.
- * 
 */
-void responseToClientInChunk(int clientSocket, const char* response) {
-  // Send the response to the client in chunks
-  const char EOT = 4;
-  size_t responseLength = strlen(response);
-  size_t sentBytes = 0;
-
-  // Allocate the chunk buffer
-  char chunk[MAX_RESPONSE_LENGTH];
-
-  while (sentBytes < responseLength) {
-    size_t chunkSize = responseLength - sentBytes;
-    if (chunkSize > MAX_RESPONSE_LENGTH - 1) {
-      chunkSize = MAX_RESPONSE_LENGTH - 1;
-    }
-
-    // Copy a chunk of the response to the chunk buffer
-    memcpy(chunk, response + sentBytes, chunkSize);
-    chunk[chunkSize] = '\0';
-
-    // Send the chunk to the client
-    if (send(clientSocket, chunk, strlen(chunk), 0) < 0) {
-      perror("Send");
-      break;
-    }
-
-    sentBytes += chunkSize;
-  }
-
-  // Send the EOT delimiter to mark the end of the response
-  if (send(clientSocket, &EOT, sizeof(EOT), 0) < 0) {
-    perror("Send");
-  }
+static void closeClient(Connection* client, int* clientSocket, Flow** flow, fd_set* master) {
+  FD_CLR(*clientSocket, master);
+  connectionClose(client);
+  *clientSocket = -1;
+  *flow = NULL;
 }
 
-/**
- * @brief etrieves the client information of all connected sockets and 
- * sends a response to the client with the list of connected clients.
- * 
- * @param clientSocket The client socket which receives the response.
- * @param clientsSockets The array of the connected client sockets.
- * @return void
-*/
-void handleListCommand(int clientSocket, int* clientSockets) {
-  // Create an array to store the client information
-  ClientInfo clients[MAX_CLIENTS];
-  int numClients = 0;
-
-  // Loop through all connected sockets and get client information
-  for (int i = 0; i < MAX_CLIENTS; i++) {
-    if (clientSockets[i] != -1) {
-      struct sockaddr_in clientAddr;
-      unsigned int addrLen = sizeof(clientAddr);
-      getpeername(clientSockets[i], (struct sockaddr*)&clientAddr, &addrLen);
-
-      // Store client hostname and port in the array
-      strcpy(clients[numClients].hostname, inet_ntoa(clientAddr.sin_addr));
-      clients[numClients].port = ntohs(clientAddr.sin_port);
-      numClients++;
-    }
-  }
-
-  // Create the response string
-  char response[MAX_RESPONSE_LENGTH];
-  sprintf(response, "Connected Clients:\n");
-  for (int i = 0; i < numClients; i++) {
-      char clientInfo[256];
-      sprintf(clientInfo, "%s:%d\n", clients[i].hostname, clients[i].port);
-      strcat(response, clientInfo);
-  }
-  sprintf(response + strlen(response), "Total Clients: %d", numClients);
-
-  // Send the response to the client in chunks
-  responseToClientInChunk(clientSocket, response);
-}
-
-/**
- * @brief retrieves the list of files in the server directory and 
- * sends a response to the client with the file names and their attributes.
- * 
- * @param clientSocket The client socket which receives the response.
- * @return void.
-*/
-void handleFilesCommand(int clientSocket) {
-  // Open the server directory
-  DIR* dir;
-  struct dirent* entry;
-  struct stat fileStat;
-  char fileAttributes[256];
-  int numFiles = 0;
-
-  dir = opendir(".");
-  if (dir == NULL) {
-    perror("opendir");
-    return;
-  }
-
-  // Prepare the response string
-  char response[4096] = "List of Files:\n";
-
-  // Read directory entries and get file information
-  while ((entry = readdir(dir)) != NULL) {
-    if (stat(entry->d_name, &fileStat) < 0) {
-      perror("stat");
-      continue;
-    }
-
-    // Format the file attributes
-    strftime(fileAttributes, sizeof(fileAttributes), "%Y-%m-%d %H:%M:%S", localtime(&fileStat.st_mtime));
-
-    // Append the filename and attributes to the response string
-    snprintf(response + strlen(response), sizeof(response) - strlen(response), "%s\t%s\n", entry->d_name, fileAttributes);
-
-    numFiles++;
-  }
-
-  // Send the response to the client in chunks
-  responseToClientInChunk(clientSocket, response);
-}
-
-/**
- * @brief handles the "Get" command from the client. It extracts the 
- * filename from the command, reads the file content, and sends a response 
- * to the client with the file information.
- * 
- * @param clientSocket The client socket which receives the response.
- * @return void.
-*/
-void handleGetCommand(int clientSocket, const char* command) {
-  // Parse the command to extract the filename and file attributes
-  char filename[256];
-  char fileAttributes[256];
-  sscanf(command, "Get %s %[^\n]", filename, fileAttributes);
-
-  // Open the file for reading
-  FILE* file = fopen(filename, "r");
-  if (file == NULL) {
-    perror("File open");
-    return;
-  }
-
-  // Read the file content and calculate the file size
-  fseek(file, 0, SEEK_END);
-  long fileSize = ftell(file);
-  fseek(file, 0, SEEK_SET);
-
-  // Read the file content into a buffer
-  char* fileContent = (char*)malloc(fileSize + 1);
-  if (fileContent == NULL) {
-    perror("Memory allocation");
-    fclose(file);
-    return;
-  }
-
-  size_t bytesRead = fread(fileContent, 1, fileSize, file);
-  if (bytesRead != (size_t)fileSize) {
-      perror("fread");
-      return;// Handle the error or exit the function
-  }
-
-  fileContent[fileSize] = '\0';
-
-  fclose(file);
-
-  // Get the last modified time of the file
-  struct stat fileStat;
-  if (stat(filename, &fileStat) == -1) {
-    perror("File stat");
-    free(fileContent);
-    return;
-  }
-  time_t lastModified = fileStat.st_mtime;
-
-  // Prepare the response with the file content and attributes
-  char response[4096];
-  snprintf(response, sizeof(response), "Filename: %s\nLast Modified: %s\nSize: %ld bytes\n\n%s",
-           filename, ctime(&lastModified), fileSize, fileContent);
-
-  free(fileContent);
-
-  // Send the response to the client in chunks
-  responseToClientInChunk(clientSocket, response);
-}
-
-/**
- * @brief handles the "Put" command from the client. It receives the file 
- * data from the client and writes it to a file in the server directory. 
- * After receiving the file, it sends a response to the client with the 
- * server hostname, IP address, and current date and time.
- * 
- * @param clientSocket The client socket which receives the response.
- * @return void.
-*/
-void handlePutCommand(int clientSocket, const char* command) {
-  // Extract the filename from the command
-  const char* filename = command + 4;
-
-  // Create a new file in the server directory
-  FILE* file = fopen(filename, "w");
-  if (file == NULL) {
-    perror("File open");
-    return;
-  }
-
-  // Set up the file descriptor set for select
-  fd_set read_fds;
-  FD_ZERO(&read_fds);
-  FD_SET(clientSocket, &read_fds);
-
-  // Set the timeout for select to 1 second
-  struct timeval timeout;
-  timeout.tv_sec = 1;
-  timeout.tv_usec = 0;
-
-  // Receive and store the file data
-  char buffer[1024];
-  ssize_t bytesRead;
-  while (select(clientSocket + 1, &read_fds, NULL, NULL, &timeout) > 0) {
-    if ((bytesRead = recv(clientSocket, buffer, sizeof(buffer), 0)) > 0) {
-      fwrite(buffer, 1, bytesRead, file);
-    }
-  }
-
-  fclose(file);
-
-  // Get the server hostname and IP address
-  char hostname[256];
-  if (gethostname(hostname, sizeof(hostname)) < 0) {
-    perror("gethostname");
-    return;
-  }
-
-  struct addrinfo hints, *serverInfo;
-  memset(&hints, 0, sizeof(hints));
-  hints.ai_family = AF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
-
-  if (getaddrinfo(hostname, NULL, &hints, &serverInfo) != 0) {
-    perror("getaddrinfo");
-    return;
-  }
-
-  char serverIP[INET6_ADDRSTRLEN];
-  void* serverAddr;
-  if (serverInfo->ai_family == AF_INET) {
-    // IPv4
-    struct sockaddr_in* ipv4 = (struct sockaddr_in*)serverInfo->ai_addr;
-    serverAddr = &(ipv4->sin_addr);
-    if (inet_ntop(AF_INET, serverAddr, serverIP, sizeof(serverIP)) == NULL) {
-      perror("inet_ntop");
-      freeaddrinfo(serverInfo);
-      return;
-    }
-  } else {
-    // IPv6
-    struct sockaddr_in6* ipv6 = (struct sockaddr_in6*)serverInfo->ai_addr;
-    serverAddr = &(ipv6->sin6_addr);
-    if (inet_ntop(AF_INET6, serverAddr, serverIP, sizeof(serverIP)) == NULL) {
-      perror("inet_ntop");
-      freeaddrinfo(serverInfo);
-      return;
+int main(int argc, char** argv) {
+  // the address and server port is passed as a command-line argument and stored in 
+  // the address and port variable. An optional store directory enables the
+  // deduplicating chunk store for uploads. -r and -g limit the send rate of 
+  // each client and of the whole server in bytes per second.
+  double clientRate = 0;
+  double globalRate = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:g:")) != -1) {
+    if (opt == 'r') {
+      clientRate = atof(optarg);
+    } else if (opt == 'g') {
+      globalRate = atof(optarg);
+    } else {
+      optind = argc + 1;
+      break;
     }
   }
 
-  freeaddrinfo(serverInfo);
-
-  // Get the current date and time
-  time_t rawTime;
-  struct tm* timeInfo;
-  time(&rawTime);
-  timeInfo = localtime(&rawTime);
-  if (timeInfo == NULL) {
-    perror("localtime");
-    return;
+  int numArgs = argc - optind;
+  if (numArgs != 2 && numArgs != 3) {
+      printf("Usage: %s [-r client bytes/s] [-g total bytes/s] [address] [port] [store directory]\n", argv[0]);
+      return 1;
   }
-  char datetime[64];
-  strftime(datetime, sizeof(datetime), "%Y-%m-%d %H:%M:%S", timeInfo);
 
-  // Send the response to the client in chunks
-  char response[MAX_RESPONSE_LENGTH];
-  snprintf(response, sizeof(response), "OK %s\n%s\n%s", hostname, serverIP, datetime);
-  responseToClientInChunk(clientSocket, response);
-}
+  const char* address = argv[optind];
+  const char* port = argv[optind + 1];
 
-/**
- * @brief The function handleCommand is called to handle the client command based on its type. 
- * It dispatches the command to the appropriate handler function.
- * 
- * @param clientSocket the client socket which receives the response.
- * @param clientSockets the list of the connected client sockets.
- * @param response the response message to be sent to the client.
- * @return void.
-*/
-void handleCommand(int clientSocket, int* clientSockets, const char* command, fd_set* master) {
-  if (strcmp(command, "List") == 0) {
-    handleListCommand(clientSocket, clientSockets);
-  }
-  else if (strncmp(command, "Files", 5) == 0) {
-    handleFilesCommand(clientSocket);
-  }
-  else if (strncmp(command, "Get", 3) == 0) {
-    handleGetCommand(clientSocket, command);
-  }
-  else if (strncmp(command, "Put", 3) == 0) {
-    handlePutCommand(clientSocket, command);
-  }
-  else if (strncmp(command, "Quit", 4) == 0) {
-    // Client requested to quit, close the connection
-    printf("Client requested to quit. Closing connection.\n");
-    close(clientSocket);
-    FD_CLR(clientSocket, master);
-    // Remove the client socket from the array
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-      if (clientSockets[i] == clientSocket) {
-        clientSockets[i] = -1;
-        break;
-      }
-    }
-  }
-  else {
-    // Invalid command received, force the client to send the right command
-    const char* response = "Invalid command. Please send a valid command (List, Files, Get <filename>, Put <filename>)";
-    responseToClientInChunk(clientSocket, response);
-  }
-}
-
-int main(int argc, char** argv) {
-  // the address and server port is passed as a command-line argument and stored in 
-  // the address and port variable.
-  if (argc != 3) {
-      printf("Usage: %s [address] [port]\n", argv[0]);
+  ChunkStore chunkStore;
+  const ChunkStore* store = NULL;
+  if (numArgs == 3) {
+    if (storeOpen(&chunkStore, argv[optind + 2]) < 0) {
       return 1;
+    }
+    store = &chunkStore;
+    printf("Deduplicating uploads into %s\n", argv[optind + 2]);
   }
 
-  const char* address = argv[1];
-  const char* port = argv[2];
-
   // The socket is created and bound to the specified port using the 
   // getaddrinfo, socket, and bind functions.
   int s_tcp;
@@ -429,6 +131,7 @@ int main(int argc, char** argv) {
 
   fd_set master;
   fd_set read_fds;
+  fd_set write_fds;
   int fdmax;
 
   FD_ZERO(&master);
@@ -437,17 +140,48 @@ int main(int argc, char** argv) {
   FD_SET(s_tcp, &master);
   fdmax = s_tcp;
 
+  // Each client's output is sent by a deficit round robin scheduler, so
+  // short responses go out between the pieces of large downloads.
+  Scheduler scheduler;
+  schedulerInit(&scheduler, SEND_QUANTUM, globalRate);
+
   int clientSockets[MAX_CLIENTS];
+  Connection connections[MAX_CLIENTS];
+  Flow* flows[MAX_CLIENTS];
   for (int i = 0; i < MAX_CLIENTS; i++) {
     clientSockets[i] = -1;
+    flows[i] = NULL;
   }
 
   while (1) {
     read_fds = master;
+    FD_ZERO(&write_fds);
+
+    // Watch the clients whose output the rate limits allow to be sent now,
+    // and wake up when tokens refill or an upload times out.
+    double now = monotonicNow();
+    double wait = schedulerDelay(&scheduler, flows, MAX_CLIENTS, now);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+      if (clientSockets[i] == -1) {
+        continue;
+      }
+      if (schedulerWantsWrite(&scheduler, flows[i], now)) {
+        FD_SET(clientSockets[i], &write_fds);
+      }
+      if (connections[i].state != CONNECTION_IDLE) {
+        double left = connections[i].deadline > now ? connections[i].deadline - now : 0;
+        if (wait < 0 || left < wait) {
+          wait = left;
+        }
+      }
+    }
+    struct timeval timeout;
+    timeout.tv_sec = (long)wait;
+    timeout.tv_usec = (long)((wait - (long)wait) * 1e6);
 
     // The select function is used to monitor the server socket 
     // and client sockets for incoming data or connections
-    if (select(fdmax + 1, &read_fds, NULL, NULL, NULL) == -1) {
+    if (select(fdmax + 1, &read_fds, &write_fds, NULL, wait >= 0 ? &timeout : NULL) == -1) {
       perror("Select");
       return 1;
     }
@@ -470,22 +204,43 @@ int main(int argc, char** argv) {
           break;
         }
       }
+      if (i == MAX_CLIENTS) {
+        printf("Too many clients, rejecting connection\n");
+        close(newSocket);
+      } else {
+        // The scheduler must never block on a slow client
+        fcntl(newSocket, F_SETFL, fcntl(newSocket, F_GETFL) | O_NONBLOCK);
+        connectionInit(&connections[i], newSocket, clientRate, SEND_QUANTUM);
+        flows[i] = &connections[i].flow;
+
+        // Add the new socket to the master set
+        FD_SET(newSocket, &master);
+
+        // Update the maximum file descriptor
+        if (newSocket > fdmax) {
+          fdmax = newSocket;
+        }
 
-      // Add the new socket to the master set
-      FD_SET(newSocket, &master);
-
-      // Update the maximum file descriptor
-      if (newSocket > fdmax) {
-        fdmax = newSocket;
+        printf("New connection established\n");
       }
-
-      printf("New connection established\n");
     }
 
     // The server continues to loop and handle client commands until it is terminated.
     for (int i = 0; i < MAX_CLIENTS; i++) {
       // If activity is detected on a client socket,
       if (clientSockets[i] != -1 && FD_ISSET(clientSockets[i], &read_fds)) {
+        Connection* client = &connections[i];
+
+        // Uploads receive at most RECEIVE_QUANTUM bytes per round so that
+        // the other clients are served in between.
+        if (client->state != CONNECTION_IDLE) {
+          if (handleUploadData(client, store, RECEIVE_QUANTUM) < 0) {
+            printf("Client closed the connection\n");
+            closeClient(client, &clientSockets[i], &flows[i], &master);
+          }
+          continue;
+        }
+
         ssize_t n;
 
         // The received command is read using the recv function.
@@ -494,23 +249,39 @@ int main(int argc, char** argv) {
           printf("Received command from client: %s\n", command);
 
           // The command is then passed to the handleCommand function for processing.
-          handleCommand(clientSockets[i], clientSockets, command, &master);
+          handleCommand(client, clientSockets, command, store);
+          if (client->closing) {
+            // Stop reading from the client, its output is still sent
+            FD_CLR(clientSockets[i], &master);
+          }
         } else if (n == 0) {
           // Connection closed by the client
           printf("Client closed the connection\n");
-          close(clientSockets[i]);
-          FD_CLR(clientSockets[i], &master);
-          clientSockets[i] = -1;
+          closeClient(client, &clientSockets[i], &flows[i], &master);
         } else {
           perror("Receive");
-          close(clientSockets[i]);
-          FD_CLR(clientSockets[i], &master);
-          clientSockets[i] = -1;
+          closeClient(client, &clientSockets[i], &flows[i], &master);
         }
       }
     }
+
+    // Send queued output, one scheduler round per loop iteration.
+    schedulerRound(&scheduler, flows, MAX_CLIENTS, &write_fds);
+
+    now = monotonicNow();
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+      if (clientSockets[i] == -1) {
+        continue;
+      }
+      if (connections[i].flow.failed ||
+          (connections[i].closing && connections[i].flow.output.pending == 0)) {
+        closeClient(&connections[i], &clientSockets[i], &flows[i], &master);
+      } else {
+        checkUploadTimeout(&connections[i], store, now);
+      }
+    }
   }
 
   close(s_tcp);
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,35 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_LENGTH 32
+#define SHA256_HEX_LENGTH (SHA256_DIGEST_LENGTH * 2)
+
+/**
+ * Incremental SHA-256 state.
+*/
+typedef struct {
+  uint32_t state[8];
+  uint64_t bitCount;
+  unsigned char block[64];
+  size_t blockLength;
+} Sha256Context;
+
+void sha256Init(Sha256Context* ctx);
+void sha256Update(Sha256Context* ctx, const void* data, size_t length);
+void sha256Final(Sha256Context* ctx, unsigned char digest[SHA256_DIGEST_LENGTH]);
+
+/**
+ * @brief Hashes a buffer in one go and writes the digest as a lowercase,
+ * NUL-terminated hex string.
+ *
+ * @param data The bytes to hash.
+ * @param length The number of bytes in data.
+ * @param hex The output buffer of SHA256_HEX_LENGTH + 1 bytes.
+ * @return void.
+*/
+void sha256Hex(const void* data, size_t length, char hex[SHA256_HEX_LENGTH + 1]);
+
+#endif
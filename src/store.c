@@ -0,0 +1,315 @@
+#include "store.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Checksum field of a manifest header while the checksum is not known, as
+// wide as a "%08x" checksum
+#define MANIFEST_NO_CHECKSUM "--------"
+
+/**
+ * @brief Builds <root>/<a>/<b>, failing instead of truncating.
+*/
+static int storePath(char* path, const ChunkStore* store, const char* a, const char* b) {
+  int n = b == NULL ? snprintf(path, STORE_PATH_LENGTH, "%s/%s", store->root, a)
+                    : snprintf(path, STORE_PATH_LENGTH, "%s/%s/%s", store->root, a, b);
+  if (n < 0 || n >= STORE_PATH_LENGTH) {
+    fprintf(stderr, "store: path too long\n");
+    return -1;
+  }
+  return 0;
+}
+
+int storeChunkPath(const ChunkStore* store, const char* hash, char* path) {
+  if (!storeValidHash(hash)) {
+    return -1;
+  }
+  char fanout[sizeof("chunks/xx")];
+  snprintf(fanout, sizeof(fanout), "chunks/%.2s", hash);
+  return storePath(path, store, fanout, hash);
+}
+
+static int makeDirectory(const char* path) {
+  if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+    perror("mkdir");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Writes a buffer to path via a temporary file and rename so that
+ * readers never see a partially written file.
+*/
+static int writeAtomically(const char* path, const void* data, size_t length) {
+  char tmpPath[STORE_PATH_LENGTH + 16];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp%ld", path, (long)getpid());
+
+  FILE* file = fopen(tmpPath, "w");
+  if (file == NULL) {
+    perror("File open");
+    return -1;
+  }
+  if (fwrite(data, 1, length, file) != length) {
+    perror("fwrite");
+    fclose(file);
+    unlink(tmpPath);
+    return -1;
+  }
+  if (fclose(file) != 0 || rename(tmpPath, path) < 0) {
+    perror("rename");
+    unlink(tmpPath);
+    return -1;
+  }
+  return 0;
+}
+
+int storeOpen(ChunkStore* store, const char* root) {
+  char path[STORE_PATH_LENGTH];
+
+  if (strlen(root) >= sizeof(store->root)) {
+    fprintf(stderr, "store: root path too long\n");
+    return -1;
+  }
+  strcpy(store->root, root);
+
+  if (makeDirectory(store->root) < 0 ||
+      storePath(path, store, "chunks", NULL) < 0 || makeDirectory(path) < 0 ||
+      storePath(path, store, "manifests", NULL) < 0 || makeDirectory(path) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+int storeValidName(const char* name) {
+  return name[0] != '\0' && name[0] != '.' && strchr(name, '/') == NULL;
+}
+
+int storeValidHash(const char* hash) {
+  size_t length = strspn(hash, "0123456789abcdef");
+  return length == SHA256_HEX_LENGTH && hash[length] == '\0';
+}
+
+int storeHasChunk(const ChunkStore* store, const char* hash) {
+  char path[STORE_PATH_LENGTH];
+  struct stat chunkStat;
+  return storeChunkPath(store, hash, path) == 0 && stat(path, &chunkStat) == 0;
+}
+
+int storePutChunk(const ChunkStore* store, const ChunkRef* ref, const unsigned char* data) {
+  char hash[SHA256_HEX_LENGTH + 1];
+  sha256Hex(data, ref->length, hash);
+  if (strcmp(hash, ref->hash) != 0) {
+    fprintf(stderr, "store: chunk %s does not match its hash\n", ref->hash);
+    return -1;
+  }
+
+  if (storeHasChunk(store, ref->hash)) {
+    return 0;
+  }
+
+  char path[STORE_PATH_LENGTH];
+  char fanout[sizeof("chunks/xx")];
+  snprintf(fanout, sizeof(fanout), "chunks/%.2s", ref->hash);
+  if (storePath(path, store, fanout, NULL) < 0 || makeDirectory(path) < 0) {
+    return -1;
+  }
+  if (storeChunkPath(store, ref->hash, path) < 0) {
+    return -1;
+  }
+  return writeAtomically(path, data, ref->length);
+}
+
+int storeWriteManifest(const ChunkStore* store, const char* name, const ChunkRef* chunks, long count,
+                       const uint32_t* checksum) {
+  char path[STORE_PATH_LENGTH];
+  if (!storeValidName(name) || storePath(path, store, "manifests", name) < 0) {
+    return -1;
+  }
+
+  // One "<hash> <length>" line per chunk after the chunk count and the file
+  // checksum. An unknown checksum is written as MANIFEST_NO_CHECKSUM so that
+  // storeSetChecksum can fill it in place later
+  size_t lineLength = SHA256_HEX_LENGTH + 24;
+  char* manifest = (char*)malloc(32 + (size_t)count * lineLength);
+  if (manifest == NULL) {
+    perror("Memory allocation");
+    return -1;
+  }
+  size_t length = checksum != NULL ? sprintf(manifest, "%ld %08x\n", count, *checksum)
+                                    : sprintf(manifest, "%ld %s\n", count, MANIFEST_NO_CHECKSUM);
+  for (long i = 0; i < count; i++) {
+    length += sprintf(manifest + length, "%s %zu\n", chunks[i].hash, chunks[i].length);
+  }
+
+  int result = writeAtomically(path, manifest, length);
+  free(manifest);
+  return result;
+}
+
+/**
+ * @brief Parses the first line of a manifest: "<count> <crc32c>", where the
+ * checksum is MANIFEST_NO_CHECKSUM until it is known. Manifests written
+ * before the checksum was kept have the count alone.
+ *
+ * @return The number of fields read, 0 on error.
+*/
+static int readManifestHeader(FILE* file, long* count, uint32_t* checksum) {
+  char header[64];
+  unsigned int crc;
+  if (fgets(header, sizeof(header), file) == NULL) {
+    return 0;
+  }
+  int fields = sscanf(header, "%ld %8x", count, &crc);
+  if (fields == 2) {
+    *checksum = crc;
+  }
+  return fields < 0 ? 0 : fields;
+}
+
+int storeReadChecksum(const ChunkStore* store, const char* name, uint32_t* checksum) {
+  char path[STORE_PATH_LENGTH];
+  if (!storeValidName(name) || storePath(path, store, "manifests", name) < 0) {
+    return 0;
+  }
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    return 0;
+  }
+  long count;
+  int fields = readManifestHeader(file, &count, checksum);
+  fclose(file);
+  return fields == 2;
+}
+
+ChunkRef* storeReadManifest(const ChunkStore* store, const char* name, long* count,
+                            uint32_t* checksum, int* hasChecksum) {
+  char path[STORE_PATH_LENGTH];
+  *count = -1;
+  *hasChecksum = 0;
+  if (!storeValidName(name) || storePath(path, store, "manifests", name) < 0) {
+    return NULL;
+  }
+
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    return NULL;
+  }
+
+  long entries;
+  int fields = readManifestHeader(file, &entries, checksum);
+  if (fields < 1 || entries < 0) {
+    fprintf(stderr, "store: corrupt manifest %s\n", name);
+    fclose(file);
+    return NULL;
+  }
+  *hasChecksum = fields == 2;
+
+  ChunkRef* chunks = NULL;
+  if (entries > 0) {
+    chunks = (ChunkRef*)malloc((size_t)entries * sizeof(ChunkRef));
+    if (chunks == NULL) {
+      perror("Memory allocation");
+      fclose(file);
+      return NULL;
+    }
+  }
+  for (long i = 0; i < entries; i++) {
+    if (fscanf(file, "%64s %zu", chunks[i].hash, &chunks[i].length) != 2) {
+      fprintf(stderr, "store: corrupt manifest %s\n", name);
+      free(chunks);
+      fclose(file);
+      return NULL;
+    }
+  }
+
+  fclose(file);
+  *count = entries;
+  return chunks;
+}
+
+int storeSetChecksum(const ChunkStore* store, const char* name, const struct stat* version, uint32_t checksum) {
+  char path[STORE_PATH_LENGTH];
+  if (!storeValidName(name) || storePath(path, store, "manifests", name) < 0) {
+    return -1;
+  }
+  int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    return -1;
+  }
+
+  // Only the checksum field of the header is rewritten, the manifest must
+  // still be the one the checksum was computed from
+  struct stat current;
+  char header[64];
+  ssize_t headerLength = -1;
+  if (fstat(fd, &current) == 0 && current.st_ino == version->st_ino &&
+      current.st_size == version->st_size && current.st_mtime == version->st_mtime &&
+      STAT_MTIME_NSEC(&current) == STAT_MTIME_NSEC(version)) {
+    headerLength = pread(fd, header, sizeof(header) - 1, 0);
+  }
+  if (headerLength <= 0) {
+    close(fd);
+    return -1;
+  }
+  header[headerLength] = '\0';
+  char* field = strchr(header, ' ');
+  char* end = strchr(header, '\n');
+  if (field == NULL || end == NULL || field > end || end - field != 9) {
+    // A manifest from before the checksum was kept has no room for it
+    close(fd);
+    return -1;
+  }
+
+  char hex[9];
+  snprintf(hex, sizeof(hex), "%08x", checksum);
+  int result = 0;
+  if (pwrite(fd, hex, 8, field + 1 - header) != 8) {
+    perror("pwrite");
+    result = -1;
+  }
+
+  // The modification time is the time of the upload
+  struct timespec times[2];
+  times[0].tv_sec = 0;
+  times[0].tv_nsec = UTIME_OMIT;
+  times[1].tv_sec = version->st_mtime;
+  times[1].tv_nsec = STAT_MTIME_NSEC(version);
+  if (futimens(fd, times) < 0) {
+    perror("futimens");
+  }
+  close(fd);
+  return result;
+}
+
+int storeStatFile(const ChunkStore* store, const char* name, struct stat* fileStat) {
+  char path[STORE_PATH_LENGTH];
+  if (!storeValidName(name) || storePath(path, store, "manifests", name) < 0) {
+    return -1;
+  }
+  return stat(path, fileStat);
+}
+
+int storeRemoveFile(const ChunkStore* store, const char* name) {
+  char path[STORE_PATH_LENGTH];
+  if (!storeValidName(name) || storePath(path, store, "manifests", name) < 0) {
+    return -1;
+  }
+  if (unlink(path) < 0 && errno != ENOENT) {
+    perror("unlink");
+    return -1;
+  }
+  return 0;
+}
+
+DIR* storeOpenManifests(const ChunkStore* store) {
+  char path[STORE_PATH_LENGTH];
+  if (storePath(path, store, "manifests", NULL) < 0) {
+    return NULL;
+  }
+  return opendir(path);
+}
@@ -0,0 +1,153 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <dirent.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "chunk.h"
+
+#define STORE_PATH_LENGTH 1024
+
+// Nanoseconds of the modification time of a struct stat
+#ifdef __APPLE__
+#define STAT_MTIME_NSEC(fileStat) ((fileStat)->st_mtimespec.tv_nsec)
+#else
+#define STAT_MTIME_NSEC(fileStat) ((fileStat)->st_mtim.tv_nsec)
+#endif
+
+/**
+ * Content-addressed chunk store. Every unique chunk is kept once under
+ * <root>/chunks/<first two hex digits>/<hash>, and every stored file is a
+ * manifest under <root>/manifests/<filename> listing its chunks in order.
+*/
+typedef struct {
+  char root[256];
+} ChunkStore;
+
+/**
+ * @brief Creates the store directories below root if they do not exist.
+ *
+ * @param store The store to initialize.
+ * @param root The store root directory.
+ * @return 0 on success, -1 on error.
+*/
+int storeOpen(ChunkStore* store, const char* root);
+
+/**
+ * @brief Checks whether a filename may be used as a manifest name.
+ * Names must be non-empty, must not contain '/' and must not start with '.'.
+ *
+ * @return 1 if the name is valid, 0 otherwise.
+*/
+int storeValidName(const char* name);
+
+/**
+ * @brief Checks whether a hash may be used to name a chunk: exactly
+ * SHA256_HEX_LENGTH lowercase hex digits. Chunk paths are built from
+ * hashes the client sends, so anything else is rejected.
+ *
+ * @return 1 if the hash is valid, 0 otherwise.
+*/
+int storeValidHash(const char* hash);
+
+/**
+ * @return 1 if a chunk with the given hash is already stored, 0 otherwise.
+*/
+int storeHasChunk(const ChunkStore* store, const char* hash);
+
+/**
+ * @brief Verifies a chunk against its hash and stores it. Storing a chunk
+ * that already exists is a no-op.
+ *
+ * @param store The chunk store.
+ * @param ref The expected hash and length of the chunk.
+ * @param data The chunk content of ref->length bytes.
+ * @return 0 on success, -1 on a hash mismatch or I/O error.
+*/
+int storePutChunk(const ChunkStore* store, const ChunkRef* ref, const unsigned char* data);
+
+/**
+ * @brief Atomically replaces the manifest of a file. All referenced chunks
+ * must already be stored.
+ *
+ * @param store The chunk store.
+ * @param name The stored filename.
+ * @param chunks The chunks of the file in order.
+ * @param count The number of chunks.
+ * @param checksum The CRC32C of the whole file, NULL if it is not known.
+ * @return 0 on success, -1 on error.
+*/
+int storeWriteManifest(const ChunkStore* store, const char* name, const ChunkRef* chunks, long count,
+                       const uint32_t* checksum);
+
+/**
+ * @brief Reads the chunk list of a stored file.
+ *
+ * @param store The chunk store.
+ * @param name The stored filename.
+ * @param count Receives the number of chunks.
+ * @param checksum Receives the CRC32C of the file if the manifest has one.
+ * @param hasChecksum Receives 1 if checksum was set, 0 otherwise.
+ * @return A malloc'd chunk array (NULL for an empty file), which the caller
+ * frees. On error NULL is returned and count is set to -1.
+*/
+ChunkRef* storeReadManifest(const ChunkStore* store, const char* name, long* count,
+                            uint32_t* checksum, int* hasChecksum);
+
+/**
+ * @brief Reads only the checksum of a stored file, without its chunk list.
+ *
+ * @return 1 if the manifest has a checksum, 0 otherwise.
+*/
+int storeReadChecksum(const ChunkStore* store, const char* name, uint32_t* checksum);
+
+/**
+ * @brief Sets the checksum of a stored file in its manifest, unless the file
+ * was replaced since version was taken. Only the fixed-width checksum field
+ * is overwritten, so the cost does not depend on the size of the file. The
+ * modification time, which is the time of the upload, is kept.
+ *
+ * @param store The chunk store.
+ * @param name The stored filename.
+ * @param version The attributes of the manifest the checksum belongs to.
+ * @param checksum The CRC32C of the file.
+ * @return 0 on success, -1 if the file changed or on error.
+*/
+int storeSetChecksum(const ChunkStore* store, const char* name, const struct stat* version, uint32_t checksum);
+
+/**
+ * @brief Builds the path of a chunk file, whether or not it exists.
+ *
+ * @param store The chunk store.
+ * @param hash The chunk hash.
+ * @param path The output buffer of STORE_PATH_LENGTH bytes.
+ * @return 0 on success, -1 if the hash is invalid or the path is too long.
+*/
+int storeChunkPath(const ChunkStore* store, const char* hash, char* path);
+
+/**
+ * @brief Stats the manifest of a stored file. st_mtime is the time of the
+ * last upload.
+ *
+ * @return 0 if the file is stored, -1 otherwise.
+*/
+int storeStatFile(const ChunkStore* store, const char* name, struct stat* fileStat);
+
+/**
+ * @brief Removes the manifest of a stored file. Chunks are kept since other
+ * files may still reference them.
+ *
+ * @return 0 on success or if the file was not stored, -1 on error.
+*/
+int storeRemoveFile(const ChunkStore* store, const char* name);
+
+/**
+ * @brief Opens the manifest directory so stored files can be listed.
+ *
+ * @return The directory stream, or NULL on error.
+*/
+DIR* storeOpenManifests(const ChunkStore* store);
+
+#endif
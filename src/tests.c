@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "crc32c.h"
+#include "sha256.h"
+#include "store.h"
+
+// Known-answer tests of the building blocks the client and the server must
+// agree on. Run "tests <group>" for one group; ctest runs each group.
+
+static int failures = 0;
+
+#define CHECK(condition)                                              \
+  do {                                                                \
+    if (!(condition)) {                                               \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+              #condition);                                            \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+/**
+ * @brief Fills a buffer with a fixed xorshift sequence, so that every run
+ * chunks the same bytes.
+*/
+static void fillPseudoRandom(unsigned char* data, size_t length, uint64_t seed) {
+  for (size_t i = 0; i < length; i++) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    data[i] = (unsigned char)(seed >> 32);
+  }
+}
+
+static void checkSha256(const char* text, size_t repeat, const char* expected) {
+  Sha256Context ctx;
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  char hex[SHA256_HEX_LENGTH + 1];
+
+  sha256Init(&ctx);
+  for (size_t i = 0; i < repeat; i++) {
+    sha256Update(&ctx, text, strlen(text));
+  }
+  sha256Final(&ctx, digest);
+  for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
+    sprintf(hex + 2 * i, "%02x", digest[i]);
+  }
+  if (strcmp(hex, expected) != 0) {
+    fprintf(stderr, "sha256 of \"%.16s\" x %zu: got %s, expected %s\n", text, repeat, hex, expected);
+    failures++;
+  }
+}
+
+static void testSha256(void) {
+  // FIPS 180-2 test vectors
+  checkSha256("", 1, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+  checkSha256("abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+  checkSha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+              "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+  checkSha256("a", 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+
+  // sha256Hex gives the same digest in one call
+  char hex[SHA256_HEX_LENGTH + 1];
+  sha256Hex("abc", 3, hex);
+  CHECK(strcmp(hex, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad") == 0);
+}
+
+static void testCrc32c(void) {
+  unsigned char data[64];
+
+  // The check value and the iSCSI vectors of RFC 3720, appendix B.4
+  CHECK(crc32cUpdate(0, "123456789", 9) == 0xe3069283);
+  memset(data, 0, 32);
+  CHECK(crc32cUpdate(0, data, 32) == 0x8a9136aa);
+  memset(data, 0xff, 32);
+  CHECK(crc32cUpdate(0, data, 32) == 0x62a8ab43);
+  for (int i = 0; i < 32; i++) {
+    data[i] = (unsigned char)i;
+  }
+  CHECK(crc32cUpdate(0, data, 32) == 0x46dd794e);
+  for (int i = 0; i < 32; i++) {
+    data[i] = (unsigned char)(31 - i);
+  }
+  CHECK(crc32cUpdate(0, data, 32) == 0x113fdb5c);
+  CHECK(crc32cUpdate(0, data, 0) == 0);
+
+  // Feeding the data in pieces, at any alignment, gives the same checksum
+  fillPseudoRandom(data, sizeof(data), 0x9e3779b97f4a7c15ULL);
+  uint32_t whole = crc32cUpdate(0, data, sizeof(data));
+  for (size_t split = 0; split <= sizeof(data); split++) {
+    uint32_t crc = crc32cUpdate(0, data, split);
+    CHECK(crc32cUpdate(crc, data + split, sizeof(data) - split) == whole);
+  }
+  printf("crc32c implementation: %s\n", crc32cImplementation());
+}
+
+static void testStore(void) {
+  const char* valid = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+  CHECK(storeValidHash(valid));
+  CHECK(!storeValidHash(""));
+  CHECK(!storeValidHash("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015a"));
+  CHECK(!storeValidHash("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad0"));
+  CHECK(!storeValidHash("BA7816BF8F01CFEA414140DE5DAE2223B00361A396177A9CB410FF61F20015AD"));
+  CHECK(!storeValidHash("../../../../../../../../../../../../../../../../../../etc/passwd"));
+  CHECK(!storeValidHash("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f2001/ad"));
+  CHECK(!storeValidHash("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015a "));
+
+  CHECK(storeValidName("file.txt"));
+  CHECK(!storeValidName(""));
+  CHECK(!storeValidName(".checksums"));
+  CHECK(!storeValidName("sub/file.txt"));
+
+  ChunkStore store;
+  snprintf(store.root, sizeof(store.root), "store");
+  char path[STORE_PATH_LENGTH];
+  CHECK(storeChunkPath(&store, valid, path) == 0);
+  CHECK(strcmp(path, "store/chunks/ba/ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad") == 0);
+  CHECK(storeChunkPath(&store, "../manifests/x", path) < 0);
+  CHECK(storeChunkPath(&store, "", path) < 0);
+
+  // A checksum learned later is written into the manifest in place,
+  // keeping the modification time and the chunk list
+  char root[] = "/tmp/store-test.XXXXXX";
+  if (mkdtemp(root) == NULL || storeOpen(&store, root) < 0) {
+    perror(root);
+    failures++;
+    return;
+  }
+  ChunkRef chunks[2] = {{.length = 10}, {.length = 20}};
+  snprintf(chunks[0].hash, sizeof(chunks[0].hash), "%s", valid);
+  snprintf(chunks[1].hash, sizeof(chunks[1].hash), "%s", valid);
+  uint32_t crc = 0;
+  CHECK(storeWriteManifest(&store, "file.txt", chunks, 2, NULL) == 0);
+  CHECK(!storeReadChecksum(&store, "file.txt", &crc));
+
+  struct stat before;
+  struct stat after;
+  CHECK(storeStatFile(&store, "file.txt", &before) == 0);
+  CHECK(storeSetChecksum(&store, "file.txt", &before, 0x0123abcd) == 0);
+  CHECK(storeReadChecksum(&store, "file.txt", &crc) && crc == 0x0123abcd);
+  CHECK(storeSetChecksum(&store, "file.txt", &before, 0xfedc3210) == 0);
+  CHECK(storeStatFile(&store, "file.txt", &after) == 0);
+  CHECK(after.st_size == before.st_size && after.st_mtime == before.st_mtime &&
+        STAT_MTIME_NSEC(&after) == STAT_MTIME_NSEC(&before));
+
+  long count;
+  int hasCrc;
+  ChunkRef* read = storeReadManifest(&store, "file.txt", &count, &crc, &hasCrc);
+  CHECK(count == 2 && hasCrc && crc == 0xfedc3210);
+  CHECK(read != NULL && read[1].length == 20 && strcmp(read[1].hash, valid) == 0);
+  free(read);
+
+  // Nothing is written once the file has been replaced
+  CHECK(storeWriteManifest(&store, "file.txt", chunks, 1, NULL) == 0);
+  CHECK(storeSetChecksum(&store, "file.txt", &before, 0x0123abcd) < 0);
+  CHECK(!storeReadChecksum(&store, "file.txt", &crc));
+
+  storeRemoveFile(&store, "file.txt");
+  snprintf(path, sizeof(path), "%s/manifests", root);
+  rmdir(path);
+  snprintf(path, sizeof(path), "%s/chunks", root);
+  rmdir(path);
+  rmdir(root);
+}
+
+/**
+ * @brief Chunks data with chunkFile, through a temporary file, and checks
+ * that the chunks, the size and the checksum match chunkBuffer.
+*/
+static void checkChunkFile(const unsigned char* data, size_t length) {
+  ChunkRef* expected;
+  long expectedCount = chunkBuffer(data, length, &expected);
+  CHECK(expectedCount >= 0);
+
+  FILE* file = tmpfile();
+  CHECK(file != NULL);
+  if (file == NULL) {
+    free(expected);
+    return;
+  }
+  CHECK(fwrite(data, 1, length, file) == length);
+  rewind(file);
+
+  ChunkRef* chunks;
+  long fileSize;
+  uint32_t crc;
+  long count = chunkFile(file, &chunks, &fileSize, &crc);
+  fclose(file);
+
+  CHECK(count == expectedCount);
+  CHECK(fileSize == (long)length);
+  CHECK(crc == crc32cUpdate(0, data, length));
+  for (long i = 0; i < count && i < expectedCount; i++) {
+    if (chunks[i].length != expected[i].length || strcmp(chunks[i].hash, expected[i].hash) != 0) {
+      fprintf(stderr, "chunk %ld of %zu bytes differs: %zu %s, expected %zu %s\n", i, length,
+              chunks[i].length, chunks[i].hash, expected[i].length, expected[i].hash);
+      failures++;
+      break;
+    }
+  }
+
+  // Every chunk but the last lies between the minimum and maximum size
+  for (long i = 0; i + 1 < expectedCount; i++) {
+    CHECK(expected[i].length >= CHUNK_MIN_SIZE && expected[i].length <= CHUNK_MAX_SIZE);
+  }
+  free(chunks);
+  free(expected);
+}
+
+static void testChunk(void) {
+  size_t length = 4 * 1024 * 1024;
+  unsigned char* data = (unsigned char*)malloc(length);
+  if (data == NULL) {
+    perror("Memory allocation");
+    failures++;
+    return;
+  }
+  fillPseudoRandom(data, length, 0x2545f4914f6cdd1dULL);
+
+  // Sizes around the window chunkFile reads through
+  size_t sizes[] = {0, 1, CHUNK_MIN_SIZE, CHUNK_MIN_SIZE + 1, CHUNK_MAX_SIZE - 1, CHUNK_MAX_SIZE,
+                    CHUNK_MAX_SIZE + 1, 2 * CHUNK_MAX_SIZE, 2 * CHUNK_MAX_SIZE + 1, 3 * CHUNK_MAX_SIZE + 7,
+                    1000003, length};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    checkChunkFile(data, sizes[i]);
+  }
+
+  // Long runs of one byte never match a boundary and are cut at the maximum
+  memset(data, 'x', 5 * CHUNK_MAX_SIZE);
+  checkChunkFile(data, 5 * CHUNK_MAX_SIZE);
+  ChunkRef* chunks;
+  long count = chunkBuffer(data, 5 * CHUNK_MAX_SIZE, &chunks);
+  CHECK(count == 5);
+  for (long i = 0; i < count; i++) {
+    CHECK(chunks[i].length == CHUNK_MAX_SIZE);
+  }
+  free(chunks);
+
+  // The boundaries of fixed data must never change, or uploads from older
+  // clients would no longer deduplicate against the chunks already stored
+  fillPseudoRandom(data, length, 0x2545f4914f6cdd1dULL);
+  count = chunkBuffer(data, 256 * 1024, &chunks);
+  size_t expected[] = {8765,  8425, 4364,  14814, 9376, 8995, 5692,  10225, 4385, 3131, 10547,
+                       11194, 4313, 9464,  3970,  9717, 9800, 9175,  14975, 2103, 11668, 9584,
+                       6815,  10338, 3327, 11594, 3635, 8988, 9171, 8330,  4581, 10492, 191};
+  CHECK(count == (long)(sizeof(expected) / sizeof(expected[0])));
+  for (long i = 0; i < count && i < (long)(sizeof(expected) / sizeof(expected[0])); i++) {
+    CHECK(chunks[i].length == expected[i]);
+  }
+  free(chunks);
+  free(data);
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    printf("Usage: %s <sha256|crc32c|store|chunk>\n", argv[0]);
+    return 2;
+  }
+
+  if (strcmp(argv[1], "sha256") == 0) {
+    testSha256();
+  } else if (strcmp(argv[1], "crc32c") == 0) {
+    testCrc32c();
+  } else if (strcmp(argv[1], "store") == 0) {
+    testStore();
+  } else if (strcmp(argv[1], "chunk") == 0) {
+    testChunk();
+  } else {
+    fprintf(stderr, "Unknown test group %s\n", argv[1]);
+    return 2;
+  }
+
+  if (failures > 0) {
+    fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("%s: all checks passed\n", argv[1]);
+  return 0;
+}